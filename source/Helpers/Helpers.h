@@ -83,6 +83,7 @@ The content herein is highly confidential and should be handled accordingly.
     #define _ftprintf  fprintf
     #define _sntprintf snprintf
     #define _tcsrchr   strrchr
+    #define _tcscmp    strcmp
     #define _tcslen    strlen
 
     typedef int64_t Timer;
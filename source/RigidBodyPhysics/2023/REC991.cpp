@@ -1,16 +1,19 @@
 #include <Helpers.h>
 #include "REC991.h"
+#include "dispatch.h"
 #include <cmath>
 #include "draw.h"
 #include <vector>
 
+#include <algorithm>
 #include <chrono>
+#include <thread>
 
 namespace REC991
 {
 using namespace rigidbody;
 static bool shouldDraw = false;
-static f time_step = 0.0005;
+f time_step = 0.0005;
 
 void GlobalInit()
 {
@@ -18,6 +21,14 @@ void GlobalInit()
     std::cin >> shouldDraw;
     if (shouldDraw)
         draw::Init();
+
+    std::cout << "Time step : " << time_step << "\n";
+}
+
+unsigned SimulationConcurrency()
+{
+    // The visualization owns the GL context of the main thread
+    return shouldDraw ? 1u : std::max(1u, std::thread::hardware_concurrency());
 }
 
 void GlobalTeardown()
@@ -26,49 +37,59 @@ void GlobalTeardown()
         draw::End();
 }
 
+template<class Integrator, class Scalar>
 rigidbody::f3x3 Simulate(rigidbody::SimulationContext const& context)
 {
     using namespace rigidbody;
+    using f3 = basic_f3<Scalar>;
+    using quat = basic_quat<Scalar>;
 
+    // The setup and the step count stay in double, only the integration runs in Scalar
     const f final_time = context.final_time;
-    const f3x3& I = context.ComputeInertiaTensor();
-    const f3x3& invI = context.ComputeInvInertiaTensor();
-    const f3& eulerMotionVector{ (I[1][1] - I[2][2]) / I[0][0],
-                                    (I[2][2] - I[0][0]) / I[1][1],
-                                    (I[0][0] - I[1][1]) / I[2][2] };
+    const PreparedContext prepared(context);
+
+    // Without the visualization the whole run is one kernel, built for the CPU (see dispatch.h)
+    if (!shouldDraw)
+    {
+        return dispatch::Integrate<Integrator, Scalar>(prepared, time_step);
+    }
+
+    const f3 eulerMotionVector = prepared.euler_motion_vector.cast<Scalar>();
 
-    f3 frame_angular_velocity = context.ComputeInitialAngularVelocity(invI);
+    f3 frame_angular_velocity = prepared.angular_velocity.cast<Scalar>();
+    const integrators::InvariantManifold<Scalar> manifold(prepared.inertia.cast<Scalar>(), frame_angular_velocity);
     f3 global_angular_velocity = frame_angular_velocity;
 
-    std::vector<f3> velocities;
-    velocities.push_back(global_angular_velocity);
+    std::vector<rigidbody::f3> velocities;
+    velocities.push_back(global_angular_velocity.template cast<f>());
 
     quat orientation;
 
     int required_steps = static_cast<int>(floor(final_time / time_step));
-
-    std::cout << "Time step : " << time_step << "\n";
+    const Scalar dt = static_cast<Scalar>(time_step);
 
     for (int step = 0; step < required_steps; ++step)
     {
-        orientation.applyRotationStep(eulerMotionVector, frame_angular_velocity, time_step);
+        integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, dt, manifold);
 
         if (step % 100 == 0)
         {
             orientation.normalize();
         }
 
-        if (shouldDraw)
-        {
-            global_angular_velocity = orientation.rotate(frame_angular_velocity);
-            velocities.push_back(global_angular_velocity * 10.0);
-            draw::display(context, quaternionToMatrix(orientation.normalized()), velocities);
-        }
+        global_angular_velocity = orientation.rotate(frame_angular_velocity);
+        velocities.push_back((global_angular_velocity * Scalar(10.0)).template cast<f>());
+        draw::display(context, BasicRotationMatrix3<Scalar>(orientation.normalized()).template cast<f>(), velocities);
     }
 
-    orientation.applyRotationStep(eulerMotionVector, frame_angular_velocity, final_time - f(required_steps * time_step));
+    integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, static_cast<Scalar>(final_time - f(required_steps * time_step)), manifold);
 
-    return quaternionToMatrix(orientation.normalized());
+    return BasicRotationMatrix3<Scalar>(orientation.normalized()).template cast<f>();
 }
 
+#define REC991_INSTANTIATE_SIMULATE(Integrator, Scalar) \
+    template rigidbody::f3x3 Simulate<Integrator, Scalar>(rigidbody::SimulationContext const& context);
+REC991_FOR_EACH_SIMULATE(REC991_INSTANTIATE_SIMULATE)
+#undef REC991_INSTANTIATE_SIMULATE
+
 } // namespace REC991
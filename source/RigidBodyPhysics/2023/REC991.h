@@ -1,12 +1,334 @@
 #pragma once
 
 #include "physicshelper.h"
+#include "integrators.h"
+#include "splitting.h"
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
 
 namespace REC991
 {
+extern rigidbody::f time_step;
+
 void GlobalInit();
 void GlobalTeardown();
 
+// Number of threads Simulate may be called from concurrently
+unsigned SimulationConcurrency();
+
+// Integrator is one of the policies of integrators.h and Scalar the precision the
+// orientation is integrated in; the context and the result stay in double. CG3, CF4
+// and RKMK4 are instantiated in REC991.cpp for double and float. float halves the
+// accuracy for more throughput, see --validate-float in main.cpp for its drift.
+// Projected<...> of the three is instantiated as well: it snaps the angular velocity
+// back onto the initial energy and angular momentum after every step, which keeps the
+// error down at larger time steps (see --project and --dt-sweep in main.cpp).
+// PolynomialExp<...> of all of those builds the step rotations with expmapPolynomial
+// instead of sin and cos, for the same result to rounding (see --fast-exp). CG3 always
+// builds them that way, PolynomialExp<CG3> is the same method.
+template<class Integrator = rigidbody::integrators::CG3, class Scalar = rigidbody::f>
 rigidbody::f3x3 Simulate(rigidbody::SimulationContext const& context);
 
-} // namespace REC991
\ No newline at end of file
+// The 24 instantiations above as an X-macro: X(Integrator, Scalar) for each of them.
+// The extern declarations below, the definitions in REC991.cpp and the kernels of
+// kernels.inl all come from this one list.
+#define REC991_SIMULATE_ADAPTERS(X, Base, Scalar) \
+    X(Base, Scalar) \
+    X(rigidbody::integrators::Projected<Base>, Scalar) \
+    X(rigidbody::integrators::PolynomialExp<Base>, Scalar) \
+    X(rigidbody::integrators::Projected<rigidbody::integrators::PolynomialExp<Base>>, Scalar)
+#define REC991_SIMULATE_SCALARS(X, Base) \
+    REC991_SIMULATE_ADAPTERS(X, Base, double) \
+    REC991_SIMULATE_ADAPTERS(X, Base, float)
+#define REC991_FOR_EACH_SIMULATE(X) \
+    REC991_SIMULATE_SCALARS(X, rigidbody::integrators::CG3) \
+    REC991_SIMULATE_SCALARS(X, rigidbody::integrators::CF4) \
+    REC991_SIMULATE_SCALARS(X, rigidbody::integrators::RKMK4)
+
+#define REC991_EXTERN_SIMULATE(Integrator, Scalar) \
+    extern template rigidbody::f3x3 Simulate<Integrator, Scalar>(rigidbody::SimulationContext const& context);
+REC991_FOR_EACH_SIMULATE(REC991_EXTERN_SIMULATE)
+#undef REC991_EXTERN_SIMULATE
+
+
+struct AdaptiveResult
+{
+    rigidbody::f3x3 orientation;
+    int accepted_steps = 0;
+    int rejected_steps = 0;
+};
+
+// Adaptive step size variant of Simulate: Runge-Kutta-Munthe-Kaas with an embedded
+// Dormand-Prince 5(4) pair, keeping the local error of each step below tolerance.
+AdaptiveResult SimulateAdaptive(rigidbody::SimulationContext const& context, rigidbody::f tolerance);
+
+// Extrapolation variant of Simulate: macro steps of at most macroStep, each one
+// Richardson extrapolated from the Integrator policy at 1, 2, 3, ... sub-steps (see
+// extrapolation.h) until two extrapolations agree within tolerance radians. A macro
+// step that does not converge is halved. The columns of a step are spread over
+// columnThreads threads when it is above 1. CG3, CF4 and RKMK4 are instantiated in
+// 2023/extrapolation.cpp.
+template<class Integrator = rigidbody::integrators::CG3>
+AdaptiveResult SimulateExtrapolation(rigidbody::SimulationContext const& context, rigidbody::f macroStep, rigidbody::f tolerance, unsigned columnThreads = 1);
+
+extern template AdaptiveResult SimulateExtrapolation<rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context, rigidbody::f macroStep, rigidbody::f tolerance, unsigned columnThreads);
+extern template AdaptiveResult SimulateExtrapolation<rigidbody::integrators::CF4>(rigidbody::SimulationContext const& context, rigidbody::f macroStep, rigidbody::f tolerance, unsigned columnThreads);
+extern template AdaptiveResult SimulateExtrapolation<rigidbody::integrators::RKMK4>(rigidbody::SimulationContext const& context, rigidbody::f macroStep, rigidbody::f tolerance, unsigned columnThreads);
+
+struct PararealResult
+{
+    rigidbody::f3x3 orientation;
+    int iterations = 0;
+    rigidbody::f max_correction = 0.0; // of the last iteration, see tolerance below
+};
+
+// Parallel-in-time variant of Simulate for a single long context: final_time is cut
+// into slices, Coarse at 10 time_step propagates coarsely across them and the Integrator
+// policy at time_step solves every slice concurrently on threads workers (0 = one per
+// hardware thread). Coarse is an integrator policy or a splitting composition of
+// splitting.h; context 7 of main.cpp converges in 3 iterations over 8 slices with
+// Yoshida6, 5 with Suzuki4 and needs all 8 with CG3. Iterates until no slice boundary
+// moves by more than tolerance, in squared Frobenius distance of the orientation plus
+// the squared angle the velocity change turns over a slice; after slices iterations it
+// equals the serial solution.
+template<class Integrator = rigidbody::integrators::CG3, class Coarse = rigidbody::splitting::Yoshida6>
+PararealResult SimulateParareal(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads = 0);
+
+extern template PararealResult SimulateParareal<rigidbody::integrators::CG3, rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::CG3, rigidbody::splitting::Suzuki4>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::CG3, rigidbody::splitting::Yoshida6>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::CF4, rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::CF4, rigidbody::splitting::Suzuki4>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::CF4, rigidbody::splitting::Yoshida6>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::RKMK4, rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::RKMK4, rigidbody::splitting::Suzuki4>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+extern template PararealResult SimulateParareal<rigidbody::integrators::RKMK4, rigidbody::splitting::Yoshida6>(rigidbody::SimulationContext const& context, unsigned slices, rigidbody::f tolerance, unsigned threads);
+
+// Closed-form solution of the torque-free top: Jacobi elliptic functions for the body
+// angular velocity and one quadrature for the precession about the angular momentum.
+// The cost does not depend on final_time.
+rigidbody::f3x3 AnalyticSimulate(rigidbody::SimulationContext const& context);
+
+// Period of the body angular velocity of the torque-free context, from the same
+// elliptic parameters as AnalyticSimulate: 4K(m) / rate for an asymmetric top, the
+// precession period of a symmetric one and a full turn when w is constant. 0 at rest.
+rigidbody::f PolhodePeriod(rigidbody::SimulationContext const& context);
+
+// Period skipping variant of Simulate: integrates one polhode period with the
+// Integrator policy, raises the rotation it produced to the number of whole periods
+// in final_time and only integrates the remainder, at a cost independent of
+// final_time. CG3, CF4 and RKMK4 are instantiated in 2023/fastforward.cpp.
+template<class Integrator = rigidbody::integrators::CG3>
+rigidbody::f3x3 SimulateFastForward(rigidbody::SimulationContext const& context);
+
+extern template rigidbody::f3x3 SimulateFastForward<rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context);
+extern template rigidbody::f3x3 SimulateFastForward<rigidbody::integrators::CF4>(rigidbody::SimulationContext const& context);
+extern template rigidbody::f3x3 SimulateFastForward<rigidbody::integrators::RKMK4>(rigidbody::SimulationContext const& context);
+
+struct TrajectorySample
+{
+    rigidbody::f3x3 orientation;
+    rigidbody::f3 angular_velocity; // in the body frame, what a gyroscope on the body reads
+};
+
+// Orientation and angular velocity at every one of sortedTimes (ascending, from 0) in a
+// single integration with the Integrator policy at time_step, up to the last time;
+// final_time of the context is not used. Between two steps the state is read from a
+// cubic Hermite interpolant: of w with its derivatives from Euler's equations, and of
+// the rotation vector from the start of the step, q(s) = q0 exp(xi(s)), whose end
+// derivatives are dt w0 and dt dexpinv(xi(1), w1). Third order like CG3, so a sample
+// costs an exp and no integration. CG3, CF4 and RKMK4 are instantiated in
+// 2023/trajectory.cpp.
+template<class Integrator = rigidbody::integrators::CG3>
+std::vector<TrajectorySample> SimulateAt(rigidbody::SimulationContext const& context, std::span<const rigidbody::f> sortedTimes);
+
+extern template std::vector<TrajectorySample> SimulateAt<rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context, std::span<const rigidbody::f> sortedTimes);
+extern template std::vector<TrajectorySample> SimulateAt<rigidbody::integrators::CF4>(rigidbody::SimulationContext const& context, std::span<const rigidbody::f> sortedTimes);
+extern template std::vector<TrajectorySample> SimulateAt<rigidbody::integrators::RKMK4>(rigidbody::SimulationContext const& context, std::span<const rigidbody::f> sortedTimes);
+
+enum class EventDirection
+{
+    Both,
+    Rising,  // from negative to zero or positive
+    Falling, // from positive to zero or negative
+};
+
+// A scalar function of the state whose zeros SimulateEvents locates, say the body
+// frame angular velocity on the intermediate axis for the flips of a tennis racket
+struct EventDetector
+{
+    std::function<rigidbody::f(const TrajectorySample&)> function;
+    EventDirection direction = EventDirection::Both;
+};
+
+struct Event
+{
+    size_t detector;        // index in the detectors span
+    rigidbody::f time;
+    TrajectorySample state; // at time
+    bool rising;
+};
+
+// Times at which the detector functions cross zero over final_time, in time order,
+// without storing the trajectory. The step loop of SimulateAt evaluates every
+// detector once per step, and a sign change between the ends of a step is refined
+// with the Illinois method on the interpolant of that step until the bracket is
+// below tolerance seconds. Two crossings within one step cancel out and are missed.
+// CG3, CF4 and RKMK4 are instantiated in 2023/trajectory.cpp.
+template<class Integrator = rigidbody::integrators::CG3>
+std::vector<Event> SimulateEvents(rigidbody::SimulationContext const& context, std::span<const EventDetector> detectors, rigidbody::f tolerance = 1e-12);
+
+extern template std::vector<Event> SimulateEvents<rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context, std::span<const EventDetector> detectors, rigidbody::f tolerance);
+extern template std::vector<Event> SimulateEvents<rigidbody::integrators::CF4>(rigidbody::SimulationContext const& context, std::span<const EventDetector> detectors, rigidbody::f tolerance);
+extern template std::vector<Event> SimulateEvents<rigidbody::integrators::RKMK4>(rigidbody::SimulationContext const& context, std::span<const EventDetector> detectors, rigidbody::f tolerance);
+
+struct Sensitivity
+{
+    static constexpr int parameter_count = 10;
+
+    rigidbody::f3x3 orientation;
+    // d orientation / d parameter, for the parameters of the context in the order
+    // initial_impulse (x, y, z), initial_impulse_application_point (x, y, z), density,
+    // lengths (x, y, z)
+    rigidbody::f3x3 jacobian[parameter_count];
+};
+
+// The final orientation of Simulate with the Integrator policy and its derivatives
+// with respect to every parameter of the context but final_time, in one run over the
+// forward mode dual numbers of dual.h instead of a run per parameter for finite
+// differences. Exact derivatives of the discrete integration, to rounding. CG3, CF4
+// and RKMK4 are instantiated in 2023/sensitivity.cpp.
+template<class Integrator = rigidbody::integrators::CG3>
+Sensitivity SimulateSensitivity(rigidbody::SimulationContext const& context);
+
+extern template Sensitivity SimulateSensitivity<rigidbody::integrators::CG3>(rigidbody::SimulationContext const& context);
+extern template Sensitivity SimulateSensitivity<rigidbody::integrators::CF4>(rigidbody::SimulationContext const& context);
+extern template Sensitivity SimulateSensitivity<rigidbody::integrators::RKMK4>(rigidbody::SimulationContext const& context);
+
+struct ShootingTarget
+{
+    rigidbody::SimulationContext context; // its initial_impulse is the first guess
+    rigidbody::f3x3 orientation;          // to reach at context.final_time
+};
+
+struct ShootingResult
+{
+    rigidbody::f3 impulse;
+    rigidbody::f3x3 orientation;  // reached with impulse
+    rigidbody::f residual = 0.0;  // Frobenius norm of orientation - target
+    int iterations = 0;
+    int evaluations = 0;          // simulations run for this target
+    bool converged = false;       // residual below tolerance
+};
+
+// Levenberg-Marquardt shooting on initial_impulse: for every target, the impulse whose
+// Simulate reaches the target orientation, minimising the squared Frobenius norm of
+// the difference. Each iteration evaluates the candidate impulse of every running
+// target and its three forward difference perturbations in one SimulateBatch, spread
+// over threads workers (0 = one per hardware thread), so an accepted step comes with
+// its Jacobian. The setup of a target is prepared once, a candidate only changes the
+// initial angular velocity. Stops at residual <= tolerance, after maxIterations, or
+// when the steps stall (converged false).
+std::vector<ShootingResult> SolveShooting(std::span<const ShootingTarget> targets, rigidbody::f tolerance = 1e-10, int maxIterations = 50, unsigned threads = 0);
+
+// Random offset of one component of a context: none, uniform in [-width, width] or
+// normal of standard deviation width
+struct Jitter
+{
+    enum class Kind
+    {
+        None,
+        Uniform,
+        Normal,
+    };
+
+    Kind kind = Kind::None;
+    rigidbody::f width = 0.0;
+
+    static constexpr Jitter uniform(rigidbody::f halfWidth) { return { Kind::Uniform, halfWidth }; }
+    static constexpr Jitter normal(rigidbody::f sigma) { return { Kind::Normal, sigma }; }
+};
+
+// Distribution of every field of a context, per component, around a base context
+struct Uncertainty
+{
+    Jitter density;
+    Jitter lengths[3];
+    Jitter initial_impulse[3];
+    Jitter initial_impulse_application_point[3];
+};
+
+struct MonteCarloStatistics
+{
+    size_t samples = 0;
+    rigidbody::f3x3 nominal_orientation; // of the base context
+    rigidbody::f3x3 mean_orientation;    // normalized sum of the quaternions, in the hemisphere of the nominal one
+    // Angle from the nominal orientation, in radians: percentiles to about 4%, exact maximum
+    rigidbody::f spread_p50 = 0.0;
+    rigidbody::f spread_p90 = 0.0;
+    rigidbody::f spread_p99 = 0.0;
+    rigidbody::f spread_max = 0.0;
+    // Runs in which the body angular velocity on the intermediate axis of the base
+    // context changes sign, 0 when the base context has two equal principal moments and
+    // no intermediate axis
+    rigidbody::f flip_fraction = 0.0;
+};
+
+// Monte Carlo uncertainty sweep of samples contexts drawn around base. Sample i is
+// drawn from a counter-based generator (Philox4x32-10 keyed by seed, the counter being
+// i and the field), so it does not depend on how samples are spread over threads, and
+// a sample with a non-positive density or length is redrawn. Samples are simulated by
+// SimulateBatch in jobs of 256 spread over threads workers (0 = one per hardware
+// thread) and reduced on the fly per job, then in job order: the statistics are the
+// same for every thread count and no orientation is stored.
+MonteCarloStatistics SimulateMonteCarlo(rigidbody::SimulationContext const& base, const Uncertainty& uncertainty, size_t samples,
+                                        uint64_t seed, unsigned threads = 0);
+
+// Discrete Moser-Veselov integration with an explicit time step (see
+// quat::applyMoserVeselovStep). It conserves energy and angular momentum exactly
+// and stays stable at much larger steps than time_step, but is second order only.
+rigidbody::f3x3 SimulateMoserVeselov(rigidbody::SimulationContext const& context, rigidbody::f timeStep);
+
+struct SplittingResult
+{
+    rigidbody::f3x3 orientation;
+    rigidbody::f max_energy_error = 0.0; // relative to the initial kinetic energy, over the run
+};
+
+// Free rotor splitting with an explicit time step, composed with one of the
+// compositions of splitting.h (Strang2, Yoshida4, Suzuki4 and Yoshida6 are
+// instantiated in 2023/splitting.cpp). Symmetric tops are integrated exactly.
+template<class Composition>
+SplittingResult SimulateSplitting(rigidbody::SimulationContext const& context, rigidbody::f timeStep);
+
+extern template SplittingResult SimulateSplitting<rigidbody::splitting::Strang2>(rigidbody::SimulationContext const& context, rigidbody::f timeStep);
+extern template SplittingResult SimulateSplitting<rigidbody::splitting::Yoshida4>(rigidbody::SimulationContext const& context, rigidbody::f timeStep);
+extern template SplittingResult SimulateSplitting<rigidbody::splitting::Suzuki4>(rigidbody::SimulationContext const& context, rigidbody::f timeStep);
+extern template SplittingResult SimulateSplitting<rigidbody::splitting::Yoshida6>(rigidbody::SimulationContext const& context, rigidbody::f timeStep);
+
+// Prints the microbenchmarks of the integration kernels (see 2023/bench.cpp)
+void RunBenchmarks();
+
+// Simulates every context with the same integrator as Simulate, several bodies per
+// SIMD instruction, and writes the final orientation of contexts[i] to results[i].
+// The float instantiation packs twice as many bodies per instruction. As in CG3, the
+// step rotations come from polynomials, a pack falls back to sin and cos for the steps
+// where one of its lanes turns by more than their range.
+template<class Scalar = rigidbody::f>
+void SimulateBatch(std::span<const rigidbody::SimulationContext> contexts, std::span<rigidbody::f3x3> results);
+
+extern template void SimulateBatch<double>(std::span<const rigidbody::SimulationContext> contexts, std::span<rigidbody::f3x3> results);
+extern template void SimulateBatch<float>(std::span<const rigidbody::SimulationContext> contexts, std::span<rigidbody::f3x3> results);
+
+// SimulateBatch of contexts prepared beforehand, at compile time for a fixed table (see
+// PreparedContext): the setup is not redone for every call.
+template<class Scalar = rigidbody::f>
+void SimulateBatch(std::span<const rigidbody::PreparedContext> contexts, std::span<rigidbody::f3x3> results);
+
+extern template void SimulateBatch<double>(std::span<const rigidbody::PreparedContext> contexts, std::span<rigidbody::f3x3> results);
+extern template void SimulateBatch<float>(std::span<const rigidbody::PreparedContext> contexts, std::span<rigidbody::f3x3> results);
+
+} // namespace REC991
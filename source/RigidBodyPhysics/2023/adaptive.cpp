@@ -0,0 +1,142 @@
+#include "REC991.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Runge-Kutta-Munthe-Kaas on SO(3) with the Dormand-Prince 5(4) pair.
+// The orientation is advanced as q1 = q0 * exp(Theta), where Theta solves
+// Theta' = dexpinv(Theta, w) in the body frame, and w follows Euler's equations.
+// Both are integrated as one 6-dimensional state so the embedded solution gives
+// a local error estimate for the angular velocity and the rotation together.
+// The system is autonomous, so the stage nodes are not needed.
+static constexpr int stages = 7;
+
+static constexpr f a[stages][stages - 1] =
+{
+    {},
+    { 1.0 / 5.0 },
+    { 3.0 / 40.0, 9.0 / 40.0 },
+    { 44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0 },
+    { 19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0 },
+    { 9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0 },
+    { 35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0 },
+};
+
+// Difference between the 5th order weights (last row of a) and the embedded 4th order ones
+static constexpr f e[stages] = { 71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0 };
+
+static constexpr f safety = 0.9;
+static constexpr f min_scale = 0.2;
+static constexpr f max_scale = 5.0;
+
+struct StepResult
+{
+    f3 w;
+    f3 theta;
+    f error;
+};
+
+StepResult rkmkStep(const f3& eulerMotionVector, const f3& w0, f h, f tolerance)
+{
+    f3 kw[stages];
+    f3 kt[stages];
+
+    f3 w = w0;
+    f3 theta;
+    for (int i = 0; i < stages; ++i)
+    {
+        if (i > 0)
+        {
+            f3 dw, dt;
+            for (int j = 0; j < i; ++j)
+            {
+                dw = dw + a[i][j] * kw[j];
+                dt = dt + a[i][j] * kt[j];
+            }
+            w = w0 + h * dw;
+            theta = h * dt;
+        }
+        kw[i] = quat::ComputeAngularAcceleration(eulerMotionVector, w);
+        kt[i] = dexpinv(theta, w);
+    }
+
+    // The last stage is evaluated at the 5th order solution
+    f3 ew, et;
+    for (int i = 0; i < stages; ++i)
+    {
+        ew = ew + e[i] * kw[i];
+        et = et + e[i] * kt[i];
+    }
+    ew = h * ew;
+    et = h * et;
+
+    // Scaled RMS norm: absolute on the rotation vector, mixed on the angular velocity
+    const f wScale = tolerance * (1.0 + std::max(w0.norm(), w.norm()));
+    f sum = 0.0;
+    for (int k = 0; k < 3; ++k)
+    {
+        sum += (ew[k] / wScale) * (ew[k] / wScale) + (et[k] / tolerance) * (et[k] / tolerance);
+    }
+
+    return { w, theta, std::sqrt(sum / 6.0) };
+}
+
+} // namespace anonymous
+
+AdaptiveResult SimulateAdaptive(SimulationContext const& context, f tolerance)
+{
+    if (!(tolerance > 0.0))
+    {
+        throw std::runtime_error("Adaptive tolerance must be positive!");
+    }
+
+    const f final_time = context.final_time;
+    const PreparedContext prepared(context);
+    const f3& eulerMotionVector = prepared.euler_motion_vector;
+
+    f3 frame_angular_velocity = prepared.angular_velocity;
+    quat orientation;
+
+    AdaptiveResult result{};
+
+    const f speed = frame_angular_velocity.norm();
+    f h = speed > 0.0 ? std::min(final_time, 0.01 / speed) : final_time;
+    f t = 0.0;
+
+    while (t < final_time && h > 0.0)
+    {
+        const bool last = t + h >= final_time;
+        const f step = last ? final_time - t : h;
+
+        const StepResult attempt = rkmkStep(eulerMotionVector, frame_angular_velocity, step, tolerance);
+        const f scale = attempt.error == 0.0
+            ? max_scale
+            : std::clamp(safety * std::pow(attempt.error, -0.2), min_scale, max_scale);
+
+        if (attempt.error <= 1.0)
+        {
+            t = last ? final_time : t + step;
+            frame_angular_velocity = attempt.w;
+            orientation = orientation * expmap(attempt.theta);
+            orientation.normalize();
+            ++result.accepted_steps;
+        }
+        else
+        {
+            ++result.rejected_steps;
+        }
+        h = step * scale;
+    }
+
+    result.orientation = quaternionToMatrix(orientation.normalized());
+    return result;
+}
+
+} // namespace REC991
@@ -0,0 +1,407 @@
+#include "REC991.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <optional>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+static constexpr f pi = std::numbers::pi_v<f>;
+
+// Carlson's symmetric elliptic integral of the first kind (duplication algorithm)
+f carlsonRF(f x, f y, f z)
+{
+    for (int i = 0; i < 64; ++i)
+    {
+        const f sx = std::sqrt(x);
+        const f sy = std::sqrt(y);
+        const f sz = std::sqrt(z);
+        const f lambda = sx * (sy + sz) + sy * sz;
+        x = 0.25 * (x + lambda);
+        y = 0.25 * (y + lambda);
+        z = 0.25 * (z + lambda);
+
+        const f mean = (x + y + z) / 3.0;
+        const f dx = 1.0 - x / mean;
+        const f dy = 1.0 - y / mean;
+        const f dz = 1.0 - z / mean;
+        if (std::max({ std::abs(dx), std::abs(dy), std::abs(dz) }) < 1e-4)
+        {
+            const f e2 = dx * dy - dz * dz;
+            const f e3 = dx * dy * dz;
+            return (1.0 - e2 / 10.0 + e3 / 14.0 + e2 * e2 / 24.0 - 3.0 * e2 * e3 / 44.0) / std::sqrt(mean);
+        }
+    }
+    return 1.0 / std::sqrt((x + y + z) / 3.0);
+}
+
+// Complete elliptic integral of the first kind, parameter m = k^2
+f ellipticK(f m)
+{
+    return carlsonRF(0.0, 1.0 - m, 1.0);
+}
+
+// Incomplete elliptic integral of the first kind F(phi | m), for any phi
+f ellipticF(f phi, f m)
+{
+    const f turns = std::round(phi / pi);
+    const f reduced = phi - turns * pi;
+    const f s = std::sin(reduced);
+    const f c = std::cos(reduced);
+    return s * carlsonRF(c * c, 1.0 - m * s * s, 1.0) + 2.0 * turns * ellipticK(m);
+}
+
+// Jacobi elliptic functions sn, cn, dn of u for parameter m in [0, 1], through the
+// arithmetic-geometric mean and descending Landen transformation (A&S 16.4).
+// u must already be reduced to a few quarter periods.
+void jacobi(f u, f m, f& sn, f& cn, f& dn)
+{
+    if (m >= 1.0 - 1e-15)
+    {
+        cn = 1.0 / std::cosh(u);
+        dn = cn;
+        sn = std::tanh(u);
+        return;
+    }
+
+    static constexpr int max_levels = 16;
+    f a[max_levels + 1];
+    f c[max_levels + 1];
+    a[0] = 1.0;
+    f b = std::sqrt(1.0 - m);
+    c[0] = std::sqrt(m);
+
+    int n = 0;
+    while (n < max_levels && std::abs(c[n]) > 1e-16 * a[n])
+    {
+        a[n + 1] = 0.5 * (a[n] + b);
+        c[n + 1] = 0.5 * (a[n] - b);
+        b = std::sqrt(a[n] * b);
+        ++n;
+    }
+
+    f phi = std::ldexp(a[n] * u, n);
+    f previous = phi;
+    for (int i = n; i > 0; --i)
+    {
+        previous = phi;
+        phi = 0.5 * (phi + std::asin(c[i] / a[i] * std::sin(phi)));
+    }
+
+    sn = std::sin(phi);
+    cn = std::cos(phi);
+    dn = n > 0 ? cn / std::cos(previous - phi) : 1.0;
+}
+
+// jacobi of any u, reduced first to the period 4K of sn and cn (K = ellipticK(m))
+void jacobiPeriodic(f u, f m, f K, f& sn, f& cn, f& dn)
+{
+    jacobi(u - 4.0 * K * std::round(u / (4.0 * K)), m, sn, cn, dn);
+}
+
+// Adaptive Gauss-Legendre quadrature (5 points against two halves)
+template<class Fn>
+f gauss5(const Fn& fn, f a, f b)
+{
+    static constexpr f x[5] = { 0.0, 0.5384693101056831, -0.5384693101056831, 0.9061798459386640, -0.9061798459386640 };
+    static constexpr f w[5] = { 0.5688888888888889, 0.4786286704993665, 0.4786286704993665, 0.2369268850561891, 0.2369268850561891 };
+    const f mid = 0.5 * (a + b);
+    const f half = 0.5 * (b - a);
+    f sum = 0.0;
+    for (int i = 0; i < 5; ++i)
+        sum += w[i] * fn(mid + half * x[i]);
+    return sum * half;
+}
+
+template<class Fn>
+f integrate(const Fn& fn, f a, f b, f whole, f tolerance, int depth)
+{
+    const f mid = 0.5 * (a + b);
+    const f left = gauss5(fn, a, mid);
+    const f right = gauss5(fn, mid, b);
+    if (depth == 0 || std::abs(left + right - whole) <= tolerance)
+        return left + right;
+    return integrate(fn, a, mid, left, 0.5 * tolerance, depth - 1)
+         + integrate(fn, mid, b, right, 0.5 * tolerance, depth - 1);
+}
+
+template<class Fn>
+f integrate(const Fn& fn, f a, f b, f tolerance)
+{
+    return integrate(fn, a, b, gauss5(fn, a, b), tolerance, 40);
+}
+
+// Trapezoidal rule over one period, which converges geometrically for periodic integrands
+template<class Fn>
+f integratePeriod(const Fn& fn, f a, f period, f tolerance)
+{
+    int n = 32;
+    f previous = 0.0;
+    f sum = 0.0;
+    for (int i = 0; i < n; ++i)
+        sum += fn(a + period * i / n);
+    f current = sum * period / n;
+    do
+    {
+        previous = current;
+        for (int i = 0; i < n; ++i)
+            sum += fn(a + period * (i + 0.5) / n);
+        n *= 2;
+        current = sum * period / n;
+    } while (std::abs(current - previous) > tolerance && n < (1 << 20));
+    return current;
+}
+
+RotationMatrix3 rotationZ(f angle)
+{
+    const f c = std::cos(angle);
+    const f s = std::sin(angle);
+    return RotationMatrix3::fromOrthonormal(f3x3{ f3(c, -s, 0.0), f3(s, c, 0.0), f3(0.0, 0.0, 1.0) });
+}
+
+RotationMatrix3 rotationX(f angle)
+{
+    const f c = std::cos(angle);
+    const f s = std::sin(angle);
+    return RotationMatrix3::fromOrthonormal(f3x3{ f3(1.0, 0.0, 0.0), f3(0.0, c, -s), f3(0.0, s, c) });
+}
+
+// Body to inertial rotation Rz(phi) Rx(theta) Rz(psi) for which the body components
+// of the inertial z axis are l (a unit vector), phi being left free.
+RotationMatrix3 eulerFrame(const f3& l, f phi)
+{
+    const f theta = std::acos(std::clamp(l[2], -1.0, 1.0));
+    const f psi = std::atan2(l[0], l[1]);
+    return rotationZ(phi) * rotationX(theta) * rotationZ(psi);
+}
+
+bool nearlyEqual(f a, f b)
+{
+    return std::abs(a - b) <= 1e-12 * std::max(std::abs(a), std::abs(b));
+}
+
+// Axes and elliptic parameters of the polhode of an asymmetric top. It circulates
+// about axis c (largest or smallest moment), b is the intermediate axis and a the
+// remaining extreme one:
+//   w_a = s_a A_a cn(u), w_b = s_b A_b sn(u), w_c = s_c A_c dn(u), u = rate t + u0
+struct Polhode
+{
+    int a, b, c;
+    f rate;
+    f m;
+
+    Polhode(const f (&moments)[3], f L2, f E2)
+    {
+        int order[3] = { 0, 1, 2 };
+        std::sort(order, order + 3, [&](int i, int j) { return moments[i] < moments[j]; });
+        b = order[1];
+        a = L2 > E2 * moments[b] ? order[0] : order[2];
+        c = L2 > E2 * moments[b] ? order[2] : order[0];
+        const f Ia = moments[a];
+        const f Ib = moments[b];
+        const f Ic = moments[c];
+
+        rate = std::sqrt((Ic - Ib) * (L2 - E2 * Ia) / (Ia * Ib * Ic));
+        m = std::clamp((Ib - Ia) * (E2 * Ic - L2) / ((Ic - Ib) * (L2 - E2 * Ia)), 0.0, 1.0);
+    }
+};
+
+// The closed forms of the torque-free motion, from the moments and the initial momentum
+struct Motion
+{
+    enum class Kind
+    {
+        Rest,
+        ConstantSpin,  // sphere, or spin about a principal axis: w is constant
+        SymmetricTop,  // moments[p] == moments[q] for the two axes other than symmetryAxis
+        AsymmetricTop, // see polhode
+    };
+
+    Kind kind;
+    int symmetryAxis = -1;
+    std::optional<Polhode> polhode;
+};
+
+Motion classifyMotion(const f (&moments)[3], const f3& w0, const f3& L)
+{
+    const f L2 = dot(L, L);
+    if (L2 == 0.0)
+    {
+        return { Motion::Kind::Rest };
+    }
+
+    const bool sphere = nearlyEqual(moments[0], moments[1]) && nearlyEqual(moments[1], moments[2]);
+    bool principalSpin = false;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        f3 e;
+        e[axis] = 1.0;
+        principalSpin = principalSpin || cross(L, e).norm() <= 1e-12 * std::sqrt(L2);
+    }
+    if (sphere || principalSpin)
+    {
+        return { Motion::Kind::ConstantSpin };
+    }
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (nearlyEqual(moments[(axis + 1) % 3], moments[(axis + 2) % 3]))
+        {
+            return { Motion::Kind::SymmetricTop, axis };
+        }
+    }
+
+    return { Motion::Kind::AsymmetricTop, -1, Polhode(moments, L2, dot(w0, L)) };
+}
+
+} // namespace anonymous
+
+f3x3 AnalyticSimulate(SimulationContext const& context)
+{
+    const f t = context.final_time;
+    const DiagonalMatrix3 I = context.ComputeInertiaTensor();
+    const DiagonalMatrix3 invI = context.ComputeInvInertiaTensor();
+    const f3 w0 = context.ComputeInitialAngularVelocity(invI);
+    const f moments[3] = { I[0], I[1], I[2] };
+
+    // The body frame coincides with the world frame at t = 0+
+    const f3 L = I * w0;
+    const f L2 = dot(L, L);
+    const Motion motion = classifyMotion(moments, w0, L);
+    switch (motion.kind)
+    {
+    case Motion::Kind::Rest:
+        return f3x3::id();
+
+    case Motion::Kind::ConstantSpin:
+        return quaternionToMatrix(expmap(t * w0));
+
+    // The body precesses about L at |L| / I1 and spins about its symmetry axis at
+    // (1 / I3 - 1 / I1) L3, both rates being constant.
+    case Motion::Kind::SymmetricTop:
+    {
+        const int axis = motion.symmetryAxis;
+        const f I1 = moments[(axis + 1) % 3];
+        f3 spin;
+        spin[axis] = (1.0 / moments[axis] - 1.0 / I1) * L[axis];
+        return quaternionToMatrix((expmap(t / I1 * L) * expmap(t * spin)).normalized());
+    }
+
+    case Motion::Kind::AsymmetricTop:
+        break;
+    }
+
+    // Asymmetric top, see Polhode
+    const f E2 = dot(w0, L);
+    const Polhode& polhode = *motion.polhode;
+    const int a = polhode.a;
+    const int b = polhode.b;
+    const int c = polhode.c;
+    const f Ia = moments[a];
+    const f Ib = moments[b];
+    const f Ic = moments[c];
+
+    const f Aa = std::sqrt(std::max(0.0, (E2 * Ic - L2) / (Ia * (Ic - Ia))));
+    const f Ab = std::sqrt(std::max(0.0, (E2 * Ic - L2) / (Ib * (Ic - Ib))));
+    const f Ac = std::sqrt(std::max(0.0, (L2 - E2 * Ia) / (Ic * (Ic - Ia))));
+    const f rate = polhode.rate;
+    const f m = polhode.m;
+
+    // Euler's equations fix s_a s_b s_c to the orientation of (a, b, c) times the sign of Ic - Ia
+    const f parity = (b == (a + 1) % 3) ? 1.0 : -1.0;
+    const f sc = w0[c] < 0.0 ? -1.0 : 1.0;
+    const f sb = parity * (Ic > Ia ? 1.0 : -1.0) * sc;
+
+    const f u0 = ellipticF(std::atan2(Ab > 0.0 ? w0[b] / (sb * Ab) : 0.0, Aa > 0.0 ? w0[a] / Aa : 1.0), m);
+    const f K = ellipticK(m);
+
+    auto angularVelocity = [&](f u)
+    {
+        f sn, cn, dn;
+        jacobiPeriodic(u, m, K, sn, cn, dn);
+        f3 w;
+        w[a] = Aa * cn;
+        w[b] = sb * Ab * sn;
+        w[c] = sc * Ac * dn;
+        return w;
+    };
+
+    // Precession about L from the one quadrature, in the Euler angles whose third
+    // axis is body axis a, which L never reaches: dphi/dt = |L| (2E - La^2 / Ia) / (|L|^2 - La^2)
+    const f Lnorm = std::sqrt(L2);
+    auto precessionRate = [&](f u)
+    {
+        f sn, cn, dn;
+        jacobiPeriodic(u, m, K, sn, cn, dn);
+        const f La = Ia * Aa * cn;
+        return Lnorm * (E2 - La * La / Ia) / (L2 - La * La);
+    };
+
+    // The rate has period 2K in u: integrate one period, skip the whole ones
+    const f U = rate * t;
+    const f period = 2.0 * K;
+    const f periods = std::floor(U / period);
+    const f remainder = U - periods * period;
+    const f tolerance = 1e-14 * Lnorm / Ia * std::max(period, 1.0);
+    const f phi = (periods * integratePeriod(precessionRate, u0, period, tolerance)
+                 + integrate(precessionRate, u0, u0 + remainder, tolerance)) / rate;
+
+    // Express the body frame in the cyclic permutation (p, q, a) so that a is the third axis
+    const int p = (a + 1) % 3;
+    const int q = (a + 2) % 3;
+    f3x3 permutation;
+    permutation[0][p] = 1.0;
+    permutation[1][q] = 1.0;
+    permutation[2][a] = 1.0;
+    const RotationMatrix3 P = RotationMatrix3::fromOrthonormal(permutation);
+
+    auto permutedMomentum = [&](const f3& w)
+    {
+        return f3(moments[p] * w[p], moments[q] * w[q], moments[a] * w[a]) / Lnorm;
+    };
+
+    const RotationMatrix3 start = eulerFrame(permutedMomentum(w0), 0.0);
+    const RotationMatrix3 current = eulerFrame(permutedMomentum(angularVelocity(U + u0)), phi);
+    return P.inverse() * start.inverse() * current * P;
+}
+
+f PolhodePeriod(SimulationContext const& context)
+{
+    const DiagonalMatrix3 I = context.ComputeInertiaTensor();
+    const DiagonalMatrix3 invI = context.ComputeInvInertiaTensor();
+    const f3 w0 = context.ComputeInitialAngularVelocity(invI);
+    const f moments[3] = { I[0], I[1], I[2] };
+
+    const f3 L = I * w0;
+    const Motion motion = classifyMotion(moments, w0, L);
+    switch (motion.kind)
+    {
+    case Motion::Kind::Rest:
+        return 0.0;
+
+    // w is constant: one full turn about it
+    case Motion::Kind::ConstantSpin:
+        return 2.0 * pi / w0.norm();
+
+    // w precesses about the symmetry axis at (1 / I3 - 1 / I1) L3
+    case Motion::Kind::SymmetricTop:
+    {
+        const int axis = motion.symmetryAxis;
+        const f spin = std::abs((1.0 / moments[axis] - 1.0 / moments[(axis + 1) % 3]) * L[axis]);
+        return spin > 0.0 ? 2.0 * pi / spin : 2.0 * pi / w0.norm();
+    }
+
+    // sn and cn have period 4K in u
+    case Motion::Kind::AsymmetricTop:
+        break;
+    }
+
+    return 4.0 * ellipticK(motion.polhode->m) / motion.polhode->rate;
+}
+
+} // namespace REC991
@@ -0,0 +1,71 @@
+#include "REC991.h"
+#include "dispatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Sorts the bodies by decreasing step count, so the packs of the kernel mix bodies of
+// close lengths, and simulates them. prepared(i) is the setup of body i.
+template<class Scalar, class Prepared>
+void SimulateBodies(size_t count, Prepared prepared, std::span<f3x3> results)
+{
+    if (count != results.size())
+    {
+        throw std::runtime_error("SimulateBatch: contexts and results sizes differ");
+    }
+
+    std::vector<BatchBody> bodies(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const PreparedContext& context = prepared(i);
+
+        BatchBody& body = bodies[i];
+        body.eulerMotionVector = context.euler_motion_vector;
+        body.angularVelocity = context.angular_velocity;
+        body.steps = std::floor(context.final_time / time_step);
+        body.lastStep = context.final_time - body.steps * time_step;
+    }
+
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return bodies[a].steps > bodies[b].steps; });
+
+    std::vector<const BatchBody*> sortedBodies(count);
+    std::vector<f3x3*> sortedResults(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        sortedBodies[i] = &bodies[order[i]];
+        sortedResults[i] = &results[order[i]];
+    }
+    dispatch::SimulateSorted<Scalar>(sortedBodies, sortedResults);
+}
+
+} // namespace anonymous
+
+template<class Scalar>
+void SimulateBatch(std::span<const SimulationContext> contexts, std::span<f3x3> results)
+{
+    SimulateBodies<Scalar>(contexts.size(), [&](size_t i) { return PreparedContext(contexts[i]); }, results);
+}
+
+template<class Scalar>
+void SimulateBatch(std::span<const PreparedContext> contexts, std::span<f3x3> results)
+{
+    SimulateBodies<Scalar>(contexts.size(), [&](size_t i) -> const PreparedContext& { return contexts[i]; }, results);
+}
+
+template void SimulateBatch<double>(std::span<const SimulationContext> contexts, std::span<f3x3> results);
+template void SimulateBatch<float>(std::span<const SimulationContext> contexts, std::span<f3x3> results);
+template void SimulateBatch<double>(std::span<const PreparedContext> contexts, std::span<f3x3> results);
+template void SimulateBatch<float>(std::span<const PreparedContext> contexts, std::span<f3x3> results);
+
+} // namespace REC991
@@ -0,0 +1,181 @@
+#include "REC991.h"
+#include "dispatch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Context 2 of main.cpp: asymmetric body tumbling close to its unstable axis
+const SimulationContext benchmark_context{ 10.0, f3(3.0, 4.0, 2.0), f3(32.0, 40.0, 10.0), f3(-0.75, 2.0, 0.5), 60.0 };
+
+f squaredDistance(const f3x3& a, const f3x3& b)
+{
+    return (a - b).squaredFrobeniusNorm();
+}
+
+struct KernelRun
+{
+    f3x3 orientation;
+    double nsPerStep;
+};
+
+// Integrates the whole context with the given step kernel, the same way Simulate does,
+// and keeps the best time out of a few runs
+template<class Step>
+KernelRun runKernel(const SimulationContext& context, Step step)
+{
+    const PreparedContext prepared(context);
+    const f3& eulerMotionVector = prepared.euler_motion_vector;
+    const int steps = static_cast<int>(std::floor(context.final_time / time_step));
+
+    KernelRun run{ f3x3(), 1e300 };
+    for (int repeat = 0; repeat < 5; ++repeat)
+    {
+        f3 w = prepared.angular_velocity;
+        quat orientation;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < steps; ++i)
+        {
+            step(orientation, eulerMotionVector, w, time_step);
+            if (i % 100 == 0)
+            {
+                orientation.normalize();
+            }
+        }
+        step(orientation, eulerMotionVector, w, context.final_time - f(steps * time_step));
+        auto end = std::chrono::steady_clock::now();
+
+        run.orientation = quaternionToMatrix(orientation.normalized());
+        run.nsPerStep = std::min(run.nsPerStep, std::chrono::duration<double, std::nano>(end - start).count() / (steps + 1));
+    }
+    return run;
+}
+
+// Best time out of a few runs of Simulate<Integrator> over the whole context, per step
+template<class Integrator>
+KernelRun runSimulate(const SimulationContext& context)
+{
+    const int steps = static_cast<int>(std::floor(context.final_time / time_step));
+
+    KernelRun run{ f3x3(), 1e300 };
+    for (int repeat = 0; repeat < 5; ++repeat)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run.orientation = Simulate<Integrator>(context);
+        auto end = std::chrono::steady_clock::now();
+        run.nsPerStep = std::min(run.nsPerStep, std::chrono::duration<double, std::nano>(end - start).count() / (steps + 1));
+    }
+    return run;
+}
+
+void printKernel(const char* name, const KernelRun& run, const f3x3& exact, int evaluations)
+{
+    std::printf("  %-28s %8.2f ns/step  %2d Euler evaluations/step  error vs analytic %.3e\n",
+                name, run.nsPerStep, evaluations, squaredDistance(run.orientation, exact));
+}
+
+template<class Integrator>
+void printIntegrator(const f3x3& exact)
+{
+    const KernelRun run = runKernel(benchmark_context, [](quat& q, const f3& e, f3& w, f dt) { integrators::step<Integrator>(q, e, w, dt); });
+    std::printf("  %-28s %8.2f ns/step  order %d  error vs analytic %.3e\n",
+                Integrator::name, run.nsPerStep, Integrator::order, squaredDistance(run.orientation, exact));
+}
+
+// Step throughput of Integrator with the rotations from libm and from expmapPolynomial
+template<class Integrator>
+void printExponentials(const f3x3& exact)
+{
+    const KernelRun libm = runKernel(benchmark_context, [](quat& q, const f3& e, f3& w, f dt) { integrators::step<Integrator>(q, e, w, dt); });
+    const KernelRun polynomial = runKernel(benchmark_context, [](quat& q, const f3& e, f3& w, f dt) { integrators::step<integrators::PolynomialExp<Integrator>>(q, e, w, dt); });
+    std::printf("  %-8s libm %8.2f ns/step  polynomial %8.2f ns/step  speedup %.2fx  error vs analytic %.3e / %.3e\n",
+                Integrator::name, libm.nsPerStep, polynomial.nsPerStep, libm.nsPerStep / polynomial.nsPerStep,
+                squaredDistance(libm.orientation, exact), squaredDistance(polynomial.orientation, exact));
+}
+
+// Largest difference between expmapPolynomial and expmap over angles up to the range of
+// the polynomials, in quaternion components
+f maxExpmapDifference()
+{
+    f maxDifference = 0.0;
+    const f maxAngle = 2.0 * std::sqrt(expmap_polynomial_range);
+    for (int i = 1; i <= 1000; ++i)
+    {
+        const f3 theta = (maxAngle * i / 1000) * f3(0.48, -0.6, 0.64);
+        const quat a = expmap(theta);
+        const quat b = expmapPolynomial(theta);
+        maxDifference = std::max({ maxDifference, std::abs(a.w - b.w), std::abs(a.x - b.x), std::abs(a.y - b.y), std::abs(a.z - b.z) });
+    }
+    return maxDifference;
+}
+
+// Best time out of a few runs of SimulateBatch over bodies, in ns per body and step
+template<class Scalar>
+double batchNsPerBodyStep(std::span<const SimulationContext> bodies, std::span<f3x3> results)
+{
+    double best = 1e300;
+    for (int repeat = 0; repeat < 5; ++repeat)
+    {
+        auto start = std::chrono::steady_clock::now();
+        SimulateBatch<Scalar>(bodies, results);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    return best / (bodies.size() * std::ceil(bodies[0].final_time / time_step));
+}
+
+} // namespace anonymous
+
+void RunBenchmarks()
+{
+    const f3x3 exact = AnalyticSimulate(benchmark_context);
+
+    // The step kernels and integrators below run at the ISA level of the program,
+    // Simulate and the batch engine at the active one
+    dispatch::PrintIsa();
+
+    std::printf("Step kernels (context 2, dt = %g)\n", time_step);
+    const KernelRun restart = runKernel(benchmark_context, [](quat& q, const f3& e, f3& w, f dt) { q.applyRotationStepRK4Restart(e, w, dt); });
+    const KernelRun reuse = runKernel(benchmark_context, [](quat& q, const f3& e, f3& w, f dt) { q.applyRotationStep(e, w, dt); });
+    const KernelRun simulate = runSimulate<integrators::CG3>(benchmark_context);
+    printKernel("applyRotationStepRK4Restart", restart, exact, 12);
+    printKernel("applyRotationStep", reuse, exact, 4);
+    printKernel("Simulate<CG3>", simulate, exact, 4);
+    std::printf("  speedup of Simulate %.2fx (target 2x)\n", restart.nsPerStep / simulate.nsPerStep);
+
+    std::printf("Integrators (context 2, dt = %g)\n", time_step);
+    printIntegrator<integrators::CG3>(exact);
+    printIntegrator<integrators::CF4>(exact);
+    printIntegrator<integrators::RKMK4>(exact);
+
+    std::printf("Exponential map (context 2, dt = %g), expmapPolynomial against expmap up to %g rad: %.3e\n",
+                time_step, 2.0 * std::sqrt(expmap_polynomial_range), maxExpmapDifference());
+    printExponentials<integrators::CF4>(exact);
+    printExponentials<integrators::RKMK4>(exact);
+
+    // Many copies of a shorter run, so every SIMD lane is busy in both precisions
+    SimulationContext shortContext = benchmark_context;
+    shortContext.final_time = 6.0;
+    std::vector<SimulationContext> bodies(64, shortContext);
+    std::vector<f3x3> results(bodies.size());
+
+    std::printf("Batch engine (%zd bodies, context 2 over %g s)\n", bodies.size(), shortContext.final_time);
+    const double doubleTime = batchNsPerBodyStep<double>(bodies, results);
+    const f doubleError = squaredDistance(results[0], AnalyticSimulate(shortContext));
+    const double floatTime = batchNsPerBodyStep<float>(bodies, results);
+    const f floatError = squaredDistance(results[0], AnalyticSimulate(shortContext));
+    std::printf("  %-28s %8.2f ns/body/step  error vs analytic %.3e\n", "double", doubleTime, doubleError);
+    std::printf("  %-28s %8.2f ns/body/step  error vs analytic %.3e\n", "float", floatTime, floatError);
+    std::printf("  speedup %.2fx\n", doubleTime / floatTime);
+}
+
+} // namespace REC991
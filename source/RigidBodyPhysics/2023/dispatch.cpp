@@ -0,0 +1,109 @@
+#include "dispatch.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace REC991::dispatch
+{
+namespace
+{
+// cpuid feature bits, and xgetbv for the register states the OS saves: AVX needs
+// XMM and YMM (bits 1, 2), AVX-512 also the opmask and ZMM states (bits 5 to 7)
+Isa detectIsa()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return Isa::AVX2;
+    }
+    return Isa::Baseline;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int leaf1[4];
+    int leaf7[4];
+    __cpuid(leaf1, 1);
+    __cpuidex(leaf7, 7, 0);
+    const bool osxsave = (leaf1[2] & (1 << 27)) != 0;
+    if (!osxsave)
+    {
+        return Isa::Baseline;
+    }
+    const unsigned long long xcr0 = _xgetbv(0);
+    const bool avx2 = (leaf7[1] & (1 << 5)) != 0 && (leaf1[2] & (1 << 12)) != 0 && (xcr0 & 0x6) == 0x6;
+    const bool avx512 = avx2 && (leaf7[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    return avx512 ? Isa::AVX512 : avx2 ? Isa::AVX2 : Isa::Baseline;
+#else
+    return Isa::Baseline;
+#endif
+}
+
+Isa& activeIsa()
+{
+#if defined(RIGIDBODY_ISA_DISPATCH)
+    static Isa active = SupportedIsa();
+#else
+    static Isa active = Isa::Baseline;
+#endif
+    return active;
+}
+} // namespace anonymous
+
+Isa SupportedIsa()
+{
+    static const Isa supported = detectIsa();
+    return supported;
+}
+
+Isa ActiveIsa()
+{
+    return activeIsa();
+}
+
+void SetActiveIsa(Isa isa)
+{
+#if !defined(RIGIDBODY_ISA_DISPATCH)
+    if (isa != Isa::Baseline)
+    {
+        throw std::runtime_error("This build has no runtime ISA dispatch!");
+    }
+#endif
+    if (isa > SupportedIsa())
+    {
+        throw std::runtime_error(std::string("The CPU does not support ") + IsaName(isa) + "!");
+    }
+    activeIsa() = isa;
+}
+
+const char* IsaName(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::AVX512:
+        return "avx512";
+    case Isa::AVX2:
+        return "avx2";
+    default:
+        return "baseline";
+    }
+}
+
+void PrintIsa()
+{
+#if defined(RIGIDBODY_ISA_DISPATCH)
+    std::printf("ISA: CPU supports %s, kernels built for baseline, avx2, avx512, active %s\n",
+                IsaName(SupportedIsa()), IsaName(ActiveIsa()));
+#else
+    std::printf("ISA: CPU supports %s, no runtime dispatch: the kernels use the flags of the build\n",
+                IsaName(SupportedIsa()));
+#endif
+}
+} // namespace REC991::dispatch
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "physicshelper.h"
+
+#include <span>
+
+// Runtime selection of the integration kernels. With RIGIDBODY_ISA_DISPATCH (the
+// NERD_RIGID_BODY_ISA_DISPATCH CMake option, off by default) the root CMakeLists.txt
+// drops the host SIMD flags, so the program and what it links (Helpers, glfw) are built
+// for the baseline of the target, and kernels.inl is compiled once per ISA level, into
+// the namespaces baseline, avx2 and avx512 (kernels_*.cpp). The widest level the CPU
+// supports is picked at startup from cpuid. Without it there is only the baseline
+// build of the kernels, with the host flags of the root CMakeLists.txt.
+namespace REC991
+{
+// Per-context setup of the batch engine, computed once with the scalar helpers of SimulationContext
+struct BatchBody
+{
+    rigidbody::f3 eulerMotionVector;
+    rigidbody::f3 angularVelocity;
+    rigidbody::f steps;
+    rigidbody::f lastStep;
+};
+
+// The kernels of every ISA level, see kernels.inl:
+//  - Integrate runs the context over its final time with the Integrator policy in
+//    precision Scalar and returns the orientation matrix.
+//  - SimulateSorted runs the batch engine over bodies sorted by decreasing step count
+//    and writes the orientation matrix of bodies[i] to *results[i].
+namespace baseline
+{
+template<class Integrator, class Scalar>
+rigidbody::f3x3 Integrate(const rigidbody::PreparedContext& context, rigidbody::f timeStep);
+template<class Scalar>
+void SimulateSorted(std::span<const BatchBody* const> bodies, std::span<rigidbody::f3x3* const> results);
+}
+
+#if defined(RIGIDBODY_ISA_DISPATCH)
+namespace avx2
+{
+template<class Integrator, class Scalar>
+rigidbody::f3x3 Integrate(const rigidbody::PreparedContext& context, rigidbody::f timeStep);
+template<class Scalar>
+void SimulateSorted(std::span<const BatchBody* const> bodies, std::span<rigidbody::f3x3* const> results);
+}
+
+namespace avx512
+{
+template<class Integrator, class Scalar>
+rigidbody::f3x3 Integrate(const rigidbody::PreparedContext& context, rigidbody::f timeStep);
+template<class Scalar>
+void SimulateSorted(std::span<const BatchBody* const> bodies, std::span<rigidbody::f3x3* const> results);
+}
+#endif
+
+namespace dispatch
+{
+enum class Isa
+{
+    Baseline,
+    AVX2,   // AVX2 and FMA
+    AVX512, // AVX-512F on top of AVX2
+};
+
+// Widest level the CPU and the OS support, from cpuid
+Isa SupportedIsa();
+
+// Level of the kernels in use: SupportedIsa unless SetActiveIsa lowered it, Baseline
+// when the build has no dispatch
+Isa ActiveIsa();
+
+// Forces a level, throws when the CPU or the build does not have it
+void SetActiveIsa(Isa isa);
+
+// "baseline", "avx2" or "avx512"
+const char* IsaName(Isa isa);
+
+// One line describing the levels, for --print-isa
+void PrintIsa();
+
+template<class Integrator, class Scalar>
+rigidbody::f3x3 Integrate(const rigidbody::PreparedContext& context, rigidbody::f timeStep)
+{
+    switch (ActiveIsa())
+    {
+#if defined(RIGIDBODY_ISA_DISPATCH)
+    case Isa::AVX512:
+        return avx512::Integrate<Integrator, Scalar>(context, timeStep);
+    case Isa::AVX2:
+        return avx2::Integrate<Integrator, Scalar>(context, timeStep);
+#endif
+    default:
+        return baseline::Integrate<Integrator, Scalar>(context, timeStep);
+    }
+}
+
+template<class Scalar>
+void SimulateSorted(std::span<const BatchBody* const> bodies, std::span<rigidbody::f3x3* const> results)
+{
+    switch (ActiveIsa())
+    {
+#if defined(RIGIDBODY_ISA_DISPATCH)
+    case Isa::AVX512:
+        return avx512::SimulateSorted<Scalar>(bodies, results);
+    case Isa::AVX2:
+        return avx2::SimulateSorted<Scalar>(bodies, results);
+#endif
+    default:
+        return baseline::SimulateSorted<Scalar>(bodies, results);
+    }
+}
+} // namespace dispatch
+} // namespace REC991
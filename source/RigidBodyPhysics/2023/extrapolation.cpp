@@ -0,0 +1,187 @@
+#include "REC991.h"
+#include "extrapolation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <cmath>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Threads computing the columns of the macro steps together with the calling thread.
+// The team lives as long as the simulation and meets at two barriers per macro step,
+// a thread spawn per step would cost more than the columns themselves.
+class ColumnTeam
+{
+public:
+    ColumnTeam(unsigned threadCount, std::function<void(int)> column)
+        : m_column(std::move(column)), m_shares(threadCount), m_start(threadCount), m_done(threadCount)
+    {
+        // Column j costs j + 1 sub-steps, deal them longest first to the least loaded thread
+        std::vector<int> loads(threadCount, 0);
+        for (int j = extrapolation::max_columns - 1; j >= 0; --j)
+        {
+            const size_t thread = std::min_element(loads.begin(), loads.end()) - loads.begin();
+            m_shares[thread].push_back(j);
+            loads[thread] += j + 1;
+        }
+
+        m_workers.reserve(threadCount - 1);
+        for (unsigned thread = 1; thread < threadCount; ++thread)
+        {
+            m_workers.emplace_back([this, thread] { work(thread); });
+        }
+    }
+
+    ~ColumnTeam()
+    {
+        m_stopping = true;
+        m_start.arrive_and_wait();
+        for (auto& worker : m_workers)
+            worker.join();
+    }
+
+    // Computes every column of the tableau
+    void run()
+    {
+        m_start.arrive_and_wait();
+        runShare(0);
+        m_done.arrive_and_wait();
+    }
+
+private:
+    void work(unsigned thread)
+    {
+        for (;;)
+        {
+            m_start.arrive_and_wait();
+            if (m_stopping)
+                return;
+            runShare(thread);
+            m_done.arrive_and_wait();
+        }
+    }
+
+    void runShare(unsigned thread)
+    {
+        for (const int j : m_shares[thread])
+            m_column(j);
+    }
+
+    std::function<void(int)> m_column;
+    std::vector<std::vector<int>> m_shares;
+    std::barrier<> m_start;
+    std::barrier<> m_done;
+    std::atomic<bool> m_stopping = false;
+    std::vector<std::thread> m_workers;
+};
+
+// A step converging within that many columns is doubled for the next one
+static constexpr int grow_columns = extrapolation::max_columns - 3;
+
+} // namespace anonymous
+
+template<class Integrator>
+AdaptiveResult SimulateExtrapolation(SimulationContext const& context, f macroStep, f tolerance, unsigned columnThreads)
+{
+    if (!(macroStep > 0.0))
+    {
+        throw std::runtime_error("Extrapolation macro step must be positive!");
+    }
+    if (!(tolerance > 0.0))
+    {
+        throw std::runtime_error("Extrapolation tolerance must be positive!");
+    }
+
+    const f final_time = context.final_time;
+    const PreparedContext prepared(context);
+    const f3& eulerMotionVector = prepared.euler_motion_vector;
+
+    f3 frame_angular_velocity = prepared.angular_velocity;
+    quat orientation;
+
+    AdaptiveResult result{};
+
+    quat columnOrientations[extrapolation::max_columns];
+    f3 columnVelocities[extrapolation::max_columns];
+    f step = macroStep;
+    const auto computeColumn = [&](int j)
+    {
+        columnOrientations[j] = orientation;
+        columnVelocities[j] = frame_angular_velocity;
+        extrapolation::column<Integrator>(j, columnOrientations[j], eulerMotionVector, columnVelocities[j], step);
+    };
+
+    // With a team every column is computed up front, alone they stop at convergence
+    std::optional<ColumnTeam> team;
+    if (columnThreads > 1)
+    {
+        team.emplace(std::min(columnThreads, unsigned(extrapolation::max_columns)), computeColumn);
+    }
+
+    f h = macroStep;
+    f t = 0.0;
+    while (t < final_time)
+    {
+        const bool last = t + h >= final_time;
+        step = last ? final_time - t : h;
+
+        if (team)
+        {
+            team->run();
+        }
+
+        extrapolation::Tableau<Integrator, f> tableau(step);
+        bool converged = false;
+        while (tableau.size() < extrapolation::max_columns && !converged)
+        {
+            const int j = tableau.size();
+            if (!team)
+            {
+                computeColumn(j);
+            }
+            converged = tableau.add(columnOrientations[j], columnVelocities[j]) <= tolerance;
+        }
+
+        if (converged)
+        {
+            t = last ? final_time : t + step;
+            orientation = tableau.orientation();
+            orientation.normalize();
+            frame_angular_velocity = tableau.angularVelocity();
+            ++result.accepted_steps;
+            // Grow back towards macroStep only when the tableau had columns to spare
+            if (tableau.size() <= grow_columns)
+            {
+                h = std::min(macroStep, 2.0 * step);
+            }
+        }
+        else
+        {
+            ++result.rejected_steps;
+            h = 0.5 * step;
+            if (t + h == t)
+            {
+                throw std::runtime_error("Extrapolation did not converge, increase the tolerance!");
+            }
+        }
+    }
+
+    result.orientation = quaternionToMatrix(orientation.normalized());
+    return result;
+}
+
+template AdaptiveResult SimulateExtrapolation<integrators::CG3>(SimulationContext const& context, f macroStep, f tolerance, unsigned columnThreads);
+template AdaptiveResult SimulateExtrapolation<integrators::CF4>(SimulationContext const& context, f macroStep, f tolerance, unsigned columnThreads);
+template AdaptiveResult SimulateExtrapolation<integrators::RKMK4>(SimulationContext const& context, f macroStep, f tolerance, unsigned columnThreads);
+
+} // namespace REC991
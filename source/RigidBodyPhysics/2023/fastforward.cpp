@@ -0,0 +1,76 @@
+#include "REC991.h"
+
+#include <cmath>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// The single period is integrated at this fraction of time_step: its error is
+// multiplied by the number of periods skipped
+static constexpr int period_substeps = 4;
+
+// Integrator steps of dt from the identity over duration, the last one shortened to land on it
+template<class Integrator>
+quat integrate(const f3& eulerMotionVector, f3 frame_angular_velocity, f duration, f dt)
+{
+    quat orientation;
+    const int required_steps = static_cast<int>(std::floor(duration / dt));
+    for (int step = 0; step < required_steps; ++step)
+    {
+        integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, dt);
+
+        if (step % 100 == 0)
+        {
+            orientation.normalize();
+        }
+    }
+
+    const f lastStep = duration - f(required_steps * dt);
+    if (lastStep > 0.0)
+    {
+        integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, lastStep);
+    }
+    return orientation.normalized();
+}
+
+} // namespace anonymous
+
+template<class Integrator>
+f3x3 SimulateFastForward(SimulationContext const& context)
+{
+    const f final_time = context.final_time;
+    const f period = PolhodePeriod(context);
+    if (period == 0.0)
+    {
+        return f3x3::id();
+    }
+
+    const f periods = std::floor(final_time / period);
+    if (periods < 1.0)
+    {
+        return Simulate<Integrator>(context);
+    }
+
+    const PreparedContext prepared(context);
+    const f3& eulerMotionVector = prepared.euler_motion_vector;
+    const f3& w0 = prepared.angular_velocity;
+
+    // w(t + period) = w(t), so q(t + period) = q(period) * q(t): the whole periods are
+    // a power of the rotation over one period, about the angular momentum
+    const quat onePeriod = integrate<Integrator>(eulerMotionVector, w0, period, time_step / period_substeps);
+    const quat wholePeriods = expmap(periods * logmap(onePeriod));
+
+    // w is back to w0 at the start of the remainder
+    const quat remainder = integrate<Integrator>(eulerMotionVector, w0, final_time - periods * period, time_step);
+
+    return quaternionToMatrix((wholePeriods * remainder).normalized());
+}
+
+template f3x3 SimulateFastForward<integrators::CG3>(SimulationContext const& context);
+template f3x3 SimulateFastForward<integrators::CF4>(SimulationContext const& context);
+template f3x3 SimulateFastForward<integrators::RKMK4>(SimulationContext const& context);
+
+} // namespace REC991
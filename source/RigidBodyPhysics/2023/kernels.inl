@@ -0,0 +1,312 @@
+// The integration kernels, compiled once per ISA level into REC991::REC991_KERNELS by
+// kernels_*.cpp (see dispatch.h). The wider levels are not built with -m flags: the
+// headers of the rest of the program are included first, for the baseline, and only
+// this file from simd.h on sits in a #pragma GCC target region. A shared inline
+// function (quat, f3x3, the integrator steps, the standard library) emitted out of
+// line here is baseline code like everywhere else, whichever copy the linker keeps.
+// What the region compiles has internal linkage (the helpers), names of its own
+// (simd.h, the REC991_KERNELS entry points) or is always inlined. The entry points are
+// flattened, so the shared functions are inlined into them and built for the wide ISA.
+
+#include "REC991.h"
+#include "dispatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <span>
+
+#if defined(REC991_SIMD_AVX2) || defined(REC991_SIMD_AVX512)
+#include <immintrin.h>
+#endif
+
+#if defined(REC991_SIMD_TARGET)
+#define REC991_PRAGMA(text) _Pragma(#text)
+#define REC991_PRAGMA_TARGET(isa) REC991_PRAGMA(GCC target(isa))
+#pragma GCC push_options
+REC991_PRAGMA_TARGET(REC991_SIMD_TARGET)
+#endif
+
+#include "simd.h"
+
+#if defined(__GNUC__)
+#define REC991_KERNEL [[gnu::flatten]]
+#else
+#define REC991_KERNEL
+#endif
+
+namespace REC991::REC991_KERNELS
+{
+using namespace rigidbody;
+
+namespace
+{
+// Structure-of-arrays views of f3 and quat, one body per lane
+template<class V>
+struct f3v
+{
+    V x, y, z;
+};
+
+template<class V>
+struct quatv
+{
+    V w, x, y, z;
+};
+
+template<class V>
+f3v<V> angularAcceleration(const f3v<V>& e, const f3v<V>& w)
+{
+    return { e.x * w.y * w.z, e.y * w.x * w.z, e.z * w.x * w.y };
+}
+
+template<class V>
+f3v<V> axpy(const f3v<V>& w, V s, const f3v<V>& k)
+{
+    return { fmadd(s, k.x, w.x), fmadd(s, k.y, w.y), fmadd(s, k.z, w.z) };
+}
+
+// RK4 stages of quat::applyRotationStep
+template<class V>
+struct rk4Stages
+{
+    f3v<V> k1, k23, k4;
+};
+
+template<class V>
+rk4Stages<V> angularVelocityStages(const f3v<V>& e, const f3v<V>& w, V dt)
+{
+    const V half = V(0.5) * dt;
+    const f3v<V> k1 = angularAcceleration(e, w);
+    const f3v<V> k2 = angularAcceleration(e, axpy(w, half, k1));
+    const f3v<V> k3 = angularAcceleration(e, axpy(w, half, k2));
+    const f3v<V> k4 = angularAcceleration(e, axpy(w, dt, k3));
+    return { k1, { k2.x + k3.x, k2.y + k3.y, k2.z + k3.z }, k4 };
+}
+
+// w0 + dt * (d1 * k1 + d23 * (k2 + k3) + d4 * k4), see quat::ComputeDenseOutputWeights
+template<class V>
+f3v<V> denseOutput(const f3v<V>& w, const rk4Stages<V>& k, V dt, f d1, f d23, f d4)
+{
+    const V a = V(d1) * dt;
+    const V b = V(d23) * dt;
+    const V c = V(d4) * dt;
+    return { fmadd(a, k.k1.x, fmadd(b, k.k23.x, fmadd(c, k.k4.x, w.x))),
+             fmadd(a, k.k1.y, fmadd(b, k.k23.y, fmadd(c, k.k4.y, w.y))),
+             fmadd(a, k.k1.z, fmadd(b, k.k23.z, fmadd(c, k.k4.z, w.z))) };
+}
+
+template<class V>
+f3v<V> scale(V s, const f3v<V>& v)
+{
+    return { s * v.x, s * v.y, s * v.z };
+}
+
+// Mirrors quat::halfRotationPolynomial. A pack with a lane out of the range of the
+// polynomials takes the sin and cos path as a whole.
+template<class V>
+quatv<V> halfRotation(const f3v<V>& h)
+{
+    const V z = h.x * h.x + h.y * h.y + h.z * h.z;
+    V c, sinc;
+    if (V::any(z > V(expmap_polynomial_range)))
+    {
+        const V angle = sqrt(z);
+        V s;
+        simd::sincos(angle, s, c);
+        sinc = select(angle > V(0.0), s / angle, V(1.0));
+    }
+    else
+    {
+        halfAngleSeries<typename V::scalar>(z, c, sinc);
+    }
+    return { c, h.x * sinc, h.y * sinc, h.z * sinc };
+}
+
+template<class V>
+quatv<V> mul(const quatv<V>& a, const quatv<V>& b)
+{
+    return { a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+             a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+             a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+             a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w };
+}
+
+// Mirrors integrators::step<CG3> (and quat::applyRotationStep): the half rotation vectors
+// b * dt / 2 * w(c * dt) are read from one RK4 step, the weights folded at compile time
+template<class V>
+void rotationStep(quatv<V>& q, f3v<V>& w, const f3v<V>& e, V dt)
+{
+    static constexpr f b1 = 13.0 / 51.0;
+    static constexpr f b2 = -2.0 / 3.0;
+    static constexpr f b3 = 24.0 / 17.0;
+    static constexpr quat::DenseOutputWeights d2 = quat::ComputeDenseOutputWeights(3.0 / 4.0);
+    static constexpr quat::DenseOutputWeights d3 = quat::ComputeDenseOutputWeights(17.0 / 24.0);
+
+    const rk4Stages<V> k = angularVelocityStages(e, w, dt);
+
+    const V halfStep = V(0.5) * dt;
+    const V halfStep2 = halfStep * dt;
+    const quatv<V> e1 = halfRotation(scale(V(b1) * halfStep, w));
+    const quatv<V> e2 = halfRotation(denseOutput(scale(V(b2) * halfStep, w), k, halfStep2, b2 * d2.d1, b2 * d2.d23, b2 * d2.d4));
+    const quatv<V> e3 = halfRotation(denseOutput(scale(V(b3) * halfStep, w), k, halfStep2, b3 * d3.d1, b3 * d3.d23, b3 * d3.d4));
+    q = mul(q, mul(mul(e1, e2), e3));
+    w = denseOutput(w, k, dt, 1.0 / 6.0, 1.0 / 3.0, 1.0 / 6.0);
+}
+
+template<class V>
+void normalize(quatv<V>& q)
+{
+    const V invNorm = V(1.0) / sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    q = { q.w * invNorm, q.x * invNorm, q.y * invNorm, q.z * invNorm };
+}
+
+template<class V>
+void blend(typename V::mask m, quatv<V>& q, const quatv<V>& nq, f3v<V>& w, const f3v<V>& nw)
+{
+    q = { select(m, nq.w, q.w), select(m, nq.x, q.x), select(m, nq.y, q.y), select(m, nq.z, q.z) };
+    w = { select(m, nw.x, w.x), select(m, nw.y, w.y), select(m, nw.z, w.z) };
+}
+
+// Advances one pack of bodies, in precision T. Lanes are sorted by decreasing step
+// count so the masked tail of the loop stays short.
+template<class T>
+void SimulatePack(const BatchBody* const bodies[], f3x3* const results[])
+{
+    using lane = simd::native<T>;
+    static constexpr int lane_count = lane::lanes;
+
+    T ex[lane_count] = {}, ey[lane_count] = {}, ez[lane_count] = {};
+    T wx[lane_count] = {}, wy[lane_count] = {}, wz[lane_count] = {};
+    T steps[lane_count] = {}, lastStep[lane_count] = {};
+
+    for (int l = 0; l < lane_count; ++l)
+    {
+        // Padding lanes stay at rest for zero steps
+        const BatchBody body = bodies[l] ? *bodies[l] : BatchBody{};
+        ex[l] = static_cast<T>(body.eulerMotionVector.x);
+        ey[l] = static_cast<T>(body.eulerMotionVector.y);
+        ez[l] = static_cast<T>(body.eulerMotionVector.z);
+        wx[l] = static_cast<T>(body.angularVelocity.x);
+        wy[l] = static_cast<T>(body.angularVelocity.y);
+        wz[l] = static_cast<T>(body.angularVelocity.z);
+        steps[l] = static_cast<T>(body.steps);
+        lastStep[l] = static_cast<T>(body.lastStep);
+    }
+
+    const f3v<lane> e{ lane::load(ex), lane::load(ey), lane::load(ez) };
+    f3v<lane> w{ lane::load(wx), lane::load(wy), lane::load(wz) };
+    quatv<lane> q{ lane(1.0), lane(0.0), lane(0.0), lane(0.0) };
+
+    const lane stepsLane = lane::load(steps);
+    const lane dt(static_cast<T>(time_step));
+    const int maxSteps = static_cast<int>(*std::max_element(steps, steps + lane_count));
+    const int minSteps = static_cast<int>(*std::min_element(steps, steps + lane_count));
+
+    for (int step = 0; step < maxSteps; ++step)
+    {
+        if (step < minSteps)
+        {
+            rotationStep(q, w, e, dt);
+        }
+        else
+        {
+            quatv<lane> nq = q;
+            f3v<lane> nw = w;
+            rotationStep(nq, nw, e, dt);
+            blend(lane(static_cast<T>(step)) < stepsLane, q, nq, w, nw);
+        }
+
+        if (step % 100 == 0)
+        {
+            normalize(q);
+        }
+    }
+
+    // Every lane does its own last partial step
+    rotationStep(q, w, e, lane::load(lastStep));
+    normalize(q);
+
+    T qw[lane_count], qx[lane_count], qy[lane_count], qz[lane_count];
+    q.w.store(qw);
+    q.x.store(qx);
+    q.y.store(qy);
+    q.z.store(qz);
+
+    for (int l = 0; l < lane_count; ++l)
+    {
+        if (results[l])
+        {
+            *results[l] = quaternionToMatrix(basic_quat<T>(qw[l], qx[l], qy[l], qz[l])).template cast<f>();
+        }
+    }
+}
+
+} // namespace anonymous
+
+template<class Integrator, class Scalar>
+REC991_KERNEL f3x3 Integrate(const PreparedContext& context, f timeStep)
+{
+    using f3 = basic_f3<Scalar>;
+    using quat = basic_quat<Scalar>;
+
+    // The step count stays in double, only the integration runs in Scalar
+    const f final_time = context.final_time;
+    const f3 eulerMotionVector = context.euler_motion_vector.cast<Scalar>();
+    f3 frame_angular_velocity = context.angular_velocity.cast<Scalar>();
+    const integrators::InvariantManifold<Scalar> manifold(context.inertia.cast<Scalar>(), frame_angular_velocity);
+
+    quat orientation;
+
+    const int required_steps = static_cast<int>(std::floor(final_time / timeStep));
+    const Scalar dt = static_cast<Scalar>(timeStep);
+
+    for (int step = 0; step < required_steps; ++step)
+    {
+        integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, dt, manifold);
+
+        if (step % 100 == 0)
+        {
+            orientation.normalize();
+        }
+    }
+
+    integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, static_cast<Scalar>(final_time - f(required_steps * timeStep)), manifold);
+
+    return BasicRotationMatrix3<Scalar>(orientation.normalized()).template cast<f>();
+}
+
+template<class Scalar>
+REC991_KERNEL void SimulateSorted(std::span<const BatchBody* const> bodies, std::span<f3x3* const> results)
+{
+    static constexpr int lane_count = simd::native<Scalar>::lanes;
+
+    for (size_t first = 0; first < bodies.size(); first += lane_count)
+    {
+        const BatchBody* packBodies[lane_count] = {};
+        f3x3* packResults[lane_count] = {};
+        for (int l = 0; l < lane_count && first + l < bodies.size(); ++l)
+        {
+            packBodies[l] = bodies[first + l];
+            packResults[l] = results[first + l];
+        }
+        SimulatePack<Scalar>(packBodies, packResults);
+    }
+}
+
+#define REC991_INSTANTIATE_INTEGRATE(Integrator, Scalar) \
+    template f3x3 Integrate<Integrator, Scalar>(const PreparedContext& context, f timeStep);
+REC991_FOR_EACH_SIMULATE(REC991_INSTANTIATE_INTEGRATE)
+#undef REC991_INSTANTIATE_INTEGRATE
+
+template void SimulateSorted<double>(std::span<const BatchBody* const> bodies, std::span<f3x3* const> results);
+template void SimulateSorted<float>(std::span<const BatchBody* const> bodies, std::span<f3x3* const> results);
+
+} // namespace REC991::REC991_KERNELS
+
+#undef REC991_KERNEL
+
+#if defined(REC991_SIMD_TARGET)
+#pragma GCC pop_options
+#undef REC991_PRAGMA_TARGET
+#undef REC991_PRAGMA
+#endif
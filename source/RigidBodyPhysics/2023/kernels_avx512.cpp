@@ -0,0 +1,11 @@
+// The integration kernels for AVX-512F, see dispatch.h. The file is built with the
+// baseline flags of the program, kernels.inl compiles the kernels in a
+// #pragma GCC target("avx512f,avx2,fma") region.
+#if defined(RIGIDBODY_ISA_DISPATCH)
+#define REC991_KERNELS avx512
+#define REC991_SIMD_TARGET "avx512f,avx2,fma"
+#define REC991_SIMD_AVX512
+#define REC991_SIMD_AVX2
+#define REC991_SIMD_FMA
+#include "kernels.inl"
+#endif
@@ -0,0 +1,4 @@
+// The integration kernels at the baseline of the target, see dispatch.h. Without
+// RIGIDBODY_ISA_DISPATCH these are the only ones, built with the flags of the whole program.
+#define REC991_KERNELS baseline
+#include "kernels.inl"
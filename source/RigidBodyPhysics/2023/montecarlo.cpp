@@ -0,0 +1,307 @@
+#include "REC991.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <stdexcept>
+#include <vector>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Samples per job of the scheduler. The partial reductions are merged in job order,
+// so the jobs, not the threads, fix the result.
+constexpr size_t samples_per_job = 256;
+
+// Redraws of a sample whose jittered density or lengths are not positive
+constexpr uint32_t max_attempts = 64;
+
+// Philox4x32-10 (Salmon et al., Parallel random numbers: as easy as 1, 2, 3): a
+// bijection of a 128 bit counter under a 64 bit key. Draw number draw of sample
+// sample is the counter { sample, draw, attempt }, with no state between draws.
+struct Philox
+{
+    uint32_t key[2];
+
+    explicit Philox(uint64_t seed) : key{ static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32) } {}
+
+    void generate(uint32_t (&counter)[4]) const
+    {
+        uint32_t k0 = key[0];
+        uint32_t k1 = key[1];
+        for (int round = 0; round < 10; ++round)
+        {
+            const uint64_t p0 = uint64_t(0xD2511F53u) * counter[0];
+            const uint64_t p1 = uint64_t(0xCD9E8D57u) * counter[2];
+            const uint32_t c1 = counter[1];
+            const uint32_t c3 = counter[3];
+            counter[0] = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+            counter[1] = static_cast<uint32_t>(p1);
+            counter[2] = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+            counter[3] = static_cast<uint32_t>(p0);
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
+
+    // Two uniform variates in (0, 1) with 53 random bits each
+    void uniforms(uint64_t sample, uint32_t draw, uint32_t attempt, f& u0, f& u1) const
+    {
+        uint32_t counter[4] = { static_cast<uint32_t>(sample), static_cast<uint32_t>(sample >> 32), draw, attempt };
+        generate(counter);
+        const auto toUnit = [](uint32_t hi, uint32_t lo)
+        {
+            return (f((((uint64_t(hi) << 32) | lo) >> 11)) + 0.5) * 0x1.0p-53;
+        };
+        u0 = toUnit(counter[0], counter[1]);
+        u1 = toUnit(counter[2], counter[3]);
+    }
+
+    f variate(const Jitter& jitter, uint64_t sample, uint32_t draw, uint32_t attempt) const
+    {
+        if (jitter.kind == Jitter::Kind::None)
+        {
+            return 0.0;
+        }
+        f u0, u1;
+        uniforms(sample, draw, attempt, u0, u1);
+        if (jitter.kind == Jitter::Kind::Uniform)
+        {
+            return jitter.width * (2.0 * u0 - 1.0);
+        }
+        // Box-Muller
+        return jitter.width * std::sqrt(-2.0 * std::log(u0)) * std::cos(2.0 * std::numbers::pi * u1);
+    }
+};
+
+// Sample sample of the sweep: base jittered field by field, one draw per component
+SimulationContext drawContext(const SimulationContext& base, const Uncertainty& uncertainty, const Philox& rng, uint64_t sample)
+{
+    for (uint32_t attempt = 0; attempt < max_attempts; ++attempt)
+    {
+        const f density = base.density + rng.variate(uncertainty.density, sample, 0, attempt);
+        f3 lengths, impulse, point;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            lengths[axis] = base.lengths[axis] + rng.variate(uncertainty.lengths[axis], sample, 1 + axis, attempt);
+            impulse[axis] = base.initial_impulse[axis] + rng.variate(uncertainty.initial_impulse[axis], sample, 4 + axis, attempt);
+            point[axis] = base.initial_impulse_application_point[axis] + rng.variate(uncertainty.initial_impulse_application_point[axis], sample, 7 + axis, attempt);
+        }
+        if (density > 0.0 && lengths[0] > 0.0 && lengths[1] > 0.0 && lengths[2] > 0.0)
+        {
+            return { density, lengths, impulse, point, base.final_time };
+        }
+    }
+    throw std::runtime_error("SimulateMonteCarlo: the distributions keep producing non-positive densities or lengths!");
+}
+
+// Histogram of the angles to the nominal orientation: bin 0 below spread_min, then
+// spread_bins_per_decade logarithmic bins per decade up to pi
+constexpr f spread_min = 1e-12;
+constexpr int spread_bins_per_decade = 64;
+const int spread_bins = 1 + static_cast<int>(std::ceil(std::log10(std::numbers::pi / spread_min) * spread_bins_per_decade));
+
+int spreadBin(f angle)
+{
+    if (!(angle >= spread_min))
+    {
+        return 0;
+    }
+    const int bin = 1 + static_cast<int>(std::log10(angle / spread_min) * spread_bins_per_decade);
+    return std::min(bin, spread_bins - 1);
+}
+
+// Lower edge of bin, 0 for the first one
+f spreadBinEdge(int bin)
+{
+    return bin == 0 ? 0.0 : spread_min * std::pow(10.0, f(bin - 1) / spread_bins_per_decade);
+}
+
+// The streaming reductions, of a job and then of the sweep
+struct Reduction
+{
+    quat orientationSum{ 0.0, 0.0, 0.0, 0.0 }; // in the hemisphere of the nominal orientation
+    std::vector<uint64_t> spread = std::vector<uint64_t>(spread_bins);
+    f maxSpread = 0.0;
+    size_t flips = 0;
+
+    void add(const f3x3& orientation, const quat& nominal, bool flipped)
+    {
+        quat q = RotationMatrix3::fromOrthonormal(orientation).toQuat();
+        const f alignment = q.w * nominal.w + q.x * nominal.x + q.y * nominal.y + q.z * nominal.z;
+        if (alignment < 0.0)
+        {
+            q = quat(-q.w, -q.x, -q.y, -q.z);
+        }
+        orientationSum = quat(orientationSum.w + q.w, orientationSum.x + q.x, orientationSum.y + q.y, orientationSum.z + q.z);
+
+        const f angle = logmap(nominal.conjugate() * q).norm();
+        ++spread[spreadBin(angle)];
+        maxSpread = std::max(maxSpread, angle);
+
+        if (flipped)
+        {
+            ++flips;
+        }
+    }
+
+    void merge(const Reduction& other)
+    {
+        orientationSum = quat(orientationSum.w + other.orientationSum.w, orientationSum.x + other.orientationSum.x,
+                              orientationSum.y + other.orientationSum.y, orientationSum.z + other.orientationSum.z);
+        for (int bin = 0; bin < spread_bins; ++bin)
+        {
+            spread[bin] += other.spread[bin];
+        }
+        maxSpread = std::max(maxSpread, other.maxSpread);
+        flips += other.flips;
+    }
+
+    // Angle below which a fraction p of the samples lie, interpolated geometrically in
+    // its bin: about 4% relative resolution
+    f percentile(f p, size_t samples) const
+    {
+        const f rank = p * f(samples);
+        uint64_t below = 0;
+        for (int bin = 0; bin < spread_bins; ++bin)
+        {
+            if (f(below + spread[bin]) >= rank && spread[bin] > 0)
+            {
+                if (bin == 0)
+                {
+                    return 0.0;
+                }
+                const f fraction = (rank - f(below)) / f(spread[bin]);
+                const f angle = spreadBinEdge(bin) * std::pow(10.0, fraction / spread_bins_per_decade);
+                return std::min(angle, maxSpread);
+            }
+            below += spread[bin];
+        }
+        return maxSpread;
+    }
+};
+
+// Axis of the middle principal moment, -1 when two moments are equal and there is none
+int intermediateAxis(const SimulationContext& context)
+{
+    const f3 inertia = context.ComputeInertiaTensor().d;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const f other0 = inertia[(axis + 1) % 3];
+        const f other1 = inertia[(axis + 2) % 3];
+        if ((inertia[axis] - other0) * (inertia[axis] - other1) < 0.0)
+        {
+            return axis;
+        }
+    }
+    return -1;
+}
+
+// Whether the body frame angular velocity on axis changes sign during the run of
+// context. Euler's equations do not involve the orientation, so the RK4 steps of the
+// angular velocity update of Simulate give the same values at the step ends on their
+// own, without the rotations SimulateEvents carries along, and the run stops at the
+// first change.
+bool flips(const SimulationContext& context, int axis)
+{
+    const PreparedContext prepared(context);
+    const f3& eulerMotionVector = prepared.euler_motion_vector;
+    f3 w = prepared.angular_velocity;
+    f reference = w[axis];
+
+    const int required_steps = static_cast<int>(std::floor(context.final_time / time_step));
+    const f lastStep = context.final_time - f(required_steps) * time_step;
+    for (int step = 0; step <= required_steps; ++step)
+    {
+        w = quat::ComputeAngularVelocity(eulerMotionVector, w, step < required_steps ? time_step : lastStep);
+        // A run starting on the plane of the axis takes its sign from the first step
+        if (reference == 0.0)
+        {
+            reference = w[axis];
+        }
+        else if (w[axis] * reference < 0.0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace anonymous
+
+MonteCarloStatistics SimulateMonteCarlo(SimulationContext const& base, const Uncertainty& uncertainty, size_t samples, uint64_t seed, unsigned threads)
+{
+    const Jitter* jitters[] = { &uncertainty.density,
+                                &uncertainty.lengths[0], &uncertainty.lengths[1], &uncertainty.lengths[2],
+                                &uncertainty.initial_impulse[0], &uncertainty.initial_impulse[1], &uncertainty.initial_impulse[2],
+                                &uncertainty.initial_impulse_application_point[0], &uncertainty.initial_impulse_application_point[1],
+                                &uncertainty.initial_impulse_application_point[2] };
+    for (const Jitter* jitter : jitters)
+    {
+        if (!(jitter->width >= 0.0) || !std::isfinite(jitter->width))
+        {
+            throw std::runtime_error("SimulateMonteCarlo: jitter widths must be finite and non-negative!");
+        }
+    }
+
+    MonteCarloStatistics statistics;
+    statistics.samples = samples;
+
+    // The nominal run, through the batch engine like the samples
+    const SimulationContext nominalContext[] = { base };
+    f3x3 nominal[1];
+    SimulateBatch<f>(nominalContext, nominal);
+    statistics.nominal_orientation = nominal[0];
+    const quat nominalQuat = RotationMatrix3::fromOrthonormal(nominal[0]).toQuat();
+
+    // The axis of the base context: a jittered cube has an intermediate axis, a random one
+    const int axis = intermediateAxis(base);
+
+    const Philox rng(seed);
+    const size_t jobs = (samples + samples_per_job - 1) / samples_per_job;
+    std::vector<Reduction> partials(jobs);
+    const std::vector<double> costs(jobs, 1.0);
+    RunScheduled(costs, [&](size_t job)
+    {
+        const size_t first = job * samples_per_job;
+        const size_t count = std::min(samples - first, samples_per_job);
+
+        std::vector<SimulationContext> contexts;
+        contexts.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            contexts.push_back(drawContext(base, uncertainty, rng, first + i));
+        }
+        std::vector<f3x3> orientations(count);
+        SimulateBatch<f>(contexts, orientations);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            partials[job].add(orientations[i], nominalQuat, axis >= 0 && flips(contexts[i], axis));
+        }
+    }, threads);
+
+    Reduction total;
+    for (const Reduction& partial : partials)
+    {
+        total.merge(partial);
+    }
+
+    if (samples > 0)
+    {
+        statistics.mean_orientation = RotationMatrix3(total.orientationSum.normalized());
+        statistics.spread_p50 = total.percentile(0.5, samples);
+        statistics.spread_p90 = total.percentile(0.9, samples);
+        statistics.spread_p99 = total.percentile(0.99, samples);
+        statistics.spread_max = total.maxSpread;
+        statistics.flip_fraction = f(total.flips) / f(samples);
+    }
+    return statistics;
+}
+
+} // namespace REC991
@@ -0,0 +1,55 @@
+#include "REC991.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+f3x3 SimulateMoserVeselov(SimulationContext const& context, f timeStep)
+{
+    if (!(timeStep > 0.0))
+    {
+        throw std::runtime_error("Moser-Veselov time step must be positive!");
+    }
+
+    const f final_time = context.final_time;
+    const DiagonalMatrix3 I = context.ComputeInertiaTensor();
+    const DiagonalMatrix3 invI = context.ComputeInvInertiaTensor();
+    const f3 inertia = I.d;
+
+    // The discrete system evolves the body angular momentum rather than the velocity
+    f3 body_angular_momentum = inertia * context.ComputeInitialAngularVelocity(invI);
+    quat orientation;
+
+    // The step reports a Newton iteration that does not converge, the error is raised here
+    auto advance = [&](f dt)
+    {
+        if (!orientation.applyMoserVeselovStep(inertia, body_angular_momentum, dt))
+        {
+            throw std::runtime_error("Moser-Veselov step did not converge, reduce the time step!");
+        }
+    };
+
+    const int required_steps = static_cast<int>(std::floor(final_time / timeStep));
+    for (int step = 0; step < required_steps; ++step)
+    {
+        advance(timeStep);
+
+        if (step % 100 == 0)
+        {
+            orientation.normalize();
+        }
+    }
+
+    const f lastStep = final_time - f(required_steps * timeStep);
+    if (lastStep > 0.0)
+    {
+        advance(lastStep);
+    }
+
+    return quaternionToMatrix(orientation.normalized());
+}
+
+} // namespace REC991
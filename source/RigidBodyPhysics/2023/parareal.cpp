@@ -0,0 +1,184 @@
+#include "REC991.h"
+#include "scheduler.h"
+#include "splitting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// The coarse propagator steps at this multiple of time_step
+static constexpr int coarse_step_factor = 10;
+
+struct SliceState
+{
+    quat orientation;
+    f3 angular_velocity;
+};
+
+// What both kinds of propagators need of the body
+struct Body
+{
+    f3 euler_motion_vector;
+    f3 inverse_inertia;
+    splitting::FreeRotor<f> rotor;
+
+    explicit Body(const PreparedContext& prepared)
+        : euler_motion_vector(prepared.euler_motion_vector),
+          inverse_inertia(1.0 / prepared.inertia.x, 1.0 / prepared.inertia.y, 1.0 / prepared.inertia.z),
+          rotor(prepared.inertia)
+    {
+    }
+};
+
+// Steps of dt over duration, the last one shortened to land on it. Propagator is an
+// orientation integrator policy or a splitting composition.
+template<class Propagator>
+SliceState propagate(SliceState state, const Body& body, f duration, f dt)
+{
+    // The splittings step the body angular momentum
+    f3 momentum;
+    if constexpr (splitting::is_composition<Propagator>)
+    {
+        momentum = body.rotor.inertia * state.angular_velocity;
+    }
+    const auto step = [&](f h)
+    {
+        if constexpr (splitting::is_composition<Propagator>)
+        {
+            body.rotor.template step<Propagator>(state.orientation, momentum, h);
+        }
+        else
+        {
+            integrators::step<Propagator>(state.orientation, body.euler_motion_vector, state.angular_velocity, h);
+        }
+    };
+
+    const int required_steps = static_cast<int>(std::floor(duration / dt));
+    for (int i = 0; i < required_steps; ++i)
+    {
+        step(dt);
+
+        if (i % 100 == 0)
+        {
+            state.orientation.normalize();
+        }
+    }
+
+    const f lastStep = duration - f(required_steps * dt);
+    if (lastStep > 0.0)
+    {
+        step(lastStep);
+    }
+    if constexpr (splitting::is_composition<Propagator>)
+    {
+        // The Casimir flow commutes with the steps: once over the slice
+        body.rotor.casimirFlow(state.orientation, momentum, duration);
+        state.angular_velocity = body.inverse_inertia * momentum;
+    }
+    state.orientation.normalize();
+    return state;
+}
+
+// Squared Frobenius distance of the orientation matrices, plus the angle the velocity
+// change would turn over a slice, squared
+f distance(const SliceState& a, const SliceState& b, f sliceTime)
+{
+    const f3x3 difference = quaternionToMatrix(a.orientation) - quaternionToMatrix(b.orientation);
+    const f velocityAngle = sliceTime * (a.angular_velocity - b.angular_velocity).norm();
+    return difference.squaredFrobeniusNorm() + velocityAngle * velocityAngle;
+}
+
+} // namespace anonymous
+
+template<class Integrator, class Coarse>
+PararealResult SimulateParareal(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads)
+{
+    if (slices == 0)
+    {
+        throw std::runtime_error("Parareal needs at least one time slice!");
+    }
+    if (!(tolerance > 0.0))
+    {
+        throw std::runtime_error("Parareal tolerance must be positive!");
+    }
+
+    const f final_time = context.final_time;
+    const PreparedContext prepared(context);
+    const Body body(prepared);
+
+    const f sliceTime = final_time / slices;
+    const f coarseStep = coarse_step_factor * time_step;
+    const auto coarse = [&](const SliceState& state) { return propagate<Coarse>(state, body, sliceTime, coarseStep); };
+    const auto fine = [&](const SliceState& state) { return propagate<Integrator>(state, body, sliceTime, time_step); };
+
+    // starts[n]: state at the beginning of slice n, starts[slices] the final state.
+    // coarseEnds[n] and fineEnds[n]: both propagators over slice n from starts[n] as of
+    // the previous iteration
+    std::vector<SliceState> starts(slices + 1);
+    std::vector<SliceState> coarseEnds(slices);
+    std::vector<SliceState> fineEnds(slices);
+
+    starts[0] = { quat(), prepared.angular_velocity };
+    for (unsigned n = 0; n < slices; ++n)
+    {
+        coarseEnds[n] = coarse(starts[n]);
+        starts[n + 1] = coarseEnds[n];
+    }
+
+    PararealResult result{};
+    std::vector<double> costs;
+    // After iteration k the first k + 1 slices match the serial fine solution exactly
+    for (unsigned k = 0; k < slices; ++k)
+    {
+        costs.assign(slices - k, 1.0);
+        RunScheduled(costs, [&](size_t i)
+        {
+            fineEnds[k + i] = fine(starts[k + i]);
+        }, threads);
+
+        // Sequential coarse sweep with the fine minus coarse correction, applied on the
+        // right in SO(3) and added in the angular velocity
+        f maxCorrection = 0.0;
+        for (unsigned n = k; n < slices; ++n)
+        {
+            const SliceState predicted = coarse(starts[n]);
+            SliceState corrected;
+            corrected.orientation = predicted.orientation * expmap(logmap(coarseEnds[n].orientation.conjugate() * fineEnds[n].orientation));
+            corrected.orientation.normalize();
+            corrected.angular_velocity = predicted.angular_velocity + (fineEnds[n].angular_velocity - coarseEnds[n].angular_velocity);
+
+            maxCorrection = std::max(maxCorrection, distance(corrected, starts[n + 1], sliceTime));
+            coarseEnds[n] = predicted;
+            starts[n + 1] = corrected;
+        }
+
+        ++result.iterations;
+        result.max_correction = maxCorrection;
+        if (maxCorrection < tolerance)
+        {
+            break;
+        }
+    }
+
+    result.orientation = quaternionToMatrix(starts[slices].orientation);
+    return result;
+}
+
+template PararealResult SimulateParareal<integrators::CG3, integrators::CG3>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::CG3, splitting::Suzuki4>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::CG3, splitting::Yoshida6>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::CF4, integrators::CG3>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::CF4, splitting::Suzuki4>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::CF4, splitting::Yoshida6>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::RKMK4, integrators::CG3>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::RKMK4, splitting::Suzuki4>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+template PararealResult SimulateParareal<integrators::RKMK4, splitting::Yoshida6>(SimulationContext const& context, unsigned slices, f tolerance, unsigned threads);
+
+} // namespace REC991
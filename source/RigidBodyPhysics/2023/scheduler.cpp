@@ -0,0 +1,126 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace REC991
+{
+namespace
+{
+// Jobs are sorted by decreasing cost front to back: the owner pops the front
+// (longest job first), thieves take the back (shortest jobs) so the owner and
+// the thieves rarely contend for the same end.
+class WorkDeque
+{
+public:
+    void push(size_t job)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(job);
+    }
+
+    bool pop(size_t& job)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_jobs.empty())
+            return false;
+        job = m_jobs.front();
+        m_jobs.pop_front();
+        return true;
+    }
+
+    bool steal(size_t& job)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_jobs.empty())
+            return false;
+        job = m_jobs.back();
+        m_jobs.pop_back();
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::deque<size_t> m_jobs;
+};
+
+} // namespace anonymous
+
+void RunScheduled(std::span<const double> costs, const std::function<void(size_t)>& job, unsigned threadCount)
+{
+    if (costs.empty())
+        return;
+
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = static_cast<unsigned>(std::min<size_t>(threadCount, costs.size()));
+
+    std::vector<size_t> order(costs.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    if (threadCount == 1)
+    {
+        for (size_t i : order)
+            job(i);
+        return;
+    }
+
+    // Deal round robin so every worker starts on one of the longest jobs
+    std::vector<std::unique_ptr<WorkDeque>> deques(threadCount);
+    for (auto& deque : deques)
+        deque = std::make_unique<WorkDeque>();
+    for (size_t k = 0; k < order.size(); ++k)
+        deques[k % threadCount]->push(order[k]);
+
+    std::atomic<bool> failed{ false };
+    std::exception_ptr firstError;
+    std::mutex errorMutex;
+
+    auto worker = [&](unsigned self)
+    {
+        size_t i;
+        while (!failed.load(std::memory_order_relaxed))
+        {
+            bool found = deques[self]->pop(i);
+            for (unsigned k = 1; !found && k < threadCount; ++k)
+                found = deques[(self + k) % threadCount]->steal(i);
+
+            // Nothing spawns new jobs: once every deque is empty we are done
+            if (!found)
+                return;
+
+            try
+            {
+                job(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!firstError)
+                    firstError = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (unsigned t = 1; t < threadCount; ++t)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : threads)
+        thread.join();
+
+    if (firstError)
+        std::rethrow_exception(firstError);
+}
+
+} // namespace REC991
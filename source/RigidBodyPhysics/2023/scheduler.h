@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <span>
+
+namespace REC991
+{
+// Runs job(i) for every i in [0, costs.size()) on threadCount workers (0 = one per
+// hardware thread). Jobs are dealt longest-first according to their estimated cost
+// to per-worker deques; a worker that runs dry steals from the cheap end of the
+// others. The first exception thrown by a job is rethrown once every worker stopped.
+void RunScheduled(std::span<const double> costs, const std::function<void(size_t)>& job, unsigned threadCount = 0);
+
+} // namespace REC991
@@ -0,0 +1,71 @@
+#include "REC991.h"
+#include "dual.h"
+
+#include <cmath>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+template<class Integrator>
+Sensitivity SimulateSensitivity(SimulationContext const& context)
+{
+    using D = Dual<f, Sensitivity::parameter_count>;
+
+    // The parameters are seeded in the order of Sensitivity::jacobian
+    const basic_f3<D> impulse(D::variable(context.initial_impulse[0], 0),
+                              D::variable(context.initial_impulse[1], 1),
+                              D::variable(context.initial_impulse[2], 2));
+    const basic_f3<D> point(D::variable(context.initial_impulse_application_point[0], 3),
+                            D::variable(context.initial_impulse_application_point[1], 4),
+                            D::variable(context.initial_impulse_application_point[2], 5));
+    const D density = D::variable(context.density, 6);
+    const basic_f3<D> lengths(D::variable(context.lengths[0], 7),
+                              D::variable(context.lengths[1], 8),
+                              D::variable(context.lengths[2], 9));
+    const BasicPreparedContext<D> prepared(BasicSimulationContext<D>(density, lengths, impulse, point, D(context.final_time)));
+
+    const basic_f3<D>& eulerMotionVector = prepared.euler_motion_vector;
+    basic_f3<D> frame_angular_velocity = prepared.angular_velocity;
+    const integrators::InvariantManifold<D> manifold(prepared.inertia, frame_angular_velocity);
+
+    basic_quat<D> orientation;
+
+    // Same steps as Simulate: the step count does not depend on the parameters
+    const int required_steps = static_cast<int>(std::floor(context.final_time / time_step));
+    const D dt(time_step);
+
+    for (int step = 0; step < required_steps; ++step)
+    {
+        integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, dt, manifold);
+
+        if (step % 100 == 0)
+        {
+            orientation.normalize();
+        }
+    }
+
+    integrators::step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, D(context.final_time - f(required_steps * time_step)), manifold);
+
+    const basic_f3x3<D> matrix = BasicRotationMatrix3<D>(orientation.normalized()).matrix();
+
+    Sensitivity result;
+    for (int row = 0; row < 3; ++row)
+    {
+        for (int column = 0; column < 3; ++column)
+        {
+            result.orientation[row][column] = matrix[row][column].value;
+            for (int parameter = 0; parameter < Sensitivity::parameter_count; ++parameter)
+            {
+                result.jacobian[parameter][row][column] = matrix[row][column].tangent[parameter];
+            }
+        }
+    }
+    return result;
+}
+
+template Sensitivity SimulateSensitivity<integrators::CG3>(SimulationContext const& context);
+template Sensitivity SimulateSensitivity<integrators::CF4>(SimulationContext const& context);
+template Sensitivity SimulateSensitivity<integrators::RKMK4>(SimulationContext const& context);
+
+} // namespace REC991
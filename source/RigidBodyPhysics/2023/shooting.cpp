@@ -0,0 +1,246 @@
+#include "REC991.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Every evaluation simulates the candidate impulse and its three forward difference
+// perturbations, so an accepted step comes with its Jacobian
+constexpr int evaluation_bodies = 4;
+
+// Targets per job of the scheduler: packs of the batch engine stay full
+constexpr size_t targets_per_job = 16;
+
+f frobeniusDot(const f3x3& a, const f3x3& b)
+{
+    f sum = 0.0;
+    for (int row = 0; row < 3; ++row)
+    {
+        sum += dot(a[row], b[row]);
+    }
+    return sum;
+}
+
+// Shooting state of one target
+struct Shooter
+{
+    PreparedContext prepared;          // setup of the target context, only the angular velocity changes
+    DiagonalMatrix3 invInertia;
+    f3 point;                          // initial_impulse_application_point
+    f3 impulse;
+    f3x3 orientation;                  // reached with impulse
+    f3x3 residual;                     // orientation - target
+    f cost = 0.0;                      // squared Frobenius norm of residual
+    f3x3 jacobian[3];                  // d orientation / d impulse[k]
+    f lambda = 1e-3;
+    f3 candidate;
+    bool active = true;
+    ShootingResult result;
+
+    f step(const f3& impulse) const
+    {
+        return 1e-7 * std::max(impulse.norm(), f(1.0));
+    }
+
+    PreparedContext at(const f3& impulse) const
+    {
+        PreparedContext context = prepared;
+        context.angular_velocity = invInertia * cross(point, impulse);
+        return context;
+    }
+
+    // The candidate and its perturbations, in the evaluation_bodies slots from contexts
+    void prepare(PreparedContext* contexts) const
+    {
+        const f h = step(candidate);
+        contexts[0] = at(candidate);
+        for (int k = 0; k < 3; ++k)
+        {
+            f3 perturbed = candidate;
+            perturbed[k] += h;
+            contexts[k + 1] = at(perturbed);
+        }
+    }
+
+    // Accepts the candidate when it lowers the cost, and adapts the damping
+    bool update(const f3x3* orientations, const f3x3& target)
+    {
+        const f3x3 candidateResidual = orientations[0] - target;
+        const f candidateCost = candidateResidual.squaredFrobeniusNorm();
+        result.evaluations += evaluation_bodies;
+        if (!(candidateCost < cost))
+        {
+            lambda *= 4.0;
+            return false;
+        }
+
+        const f h = step(candidate);
+        for (int k = 0; k < 3; ++k)
+        {
+            jacobian[k] = (orientations[k + 1] - orientations[0]) * (1.0 / h);
+        }
+        impulse = candidate;
+        orientation = orientations[0];
+        residual = candidateResidual;
+        cost = candidateCost;
+        lambda = std::max(lambda / 3.0, 1e-12);
+        return true;
+    }
+
+    // Levenberg-Marquardt step (J^T J + lambda trace(J^T J) / 3) delta = -J^T r, the
+    // 3x3 system solved by Cramer's rule on the cross products of its columns
+    f3 solve() const
+    {
+        f3 columns[3];
+        f3 gradient;
+        for (int i = 0; i < 3; ++i)
+        {
+            gradient[i] = frobeniusDot(jacobian[i], residual);
+            for (int j = 0; j < 3; ++j)
+            {
+                columns[j][i] = frobeniusDot(jacobian[i], jacobian[j]);
+            }
+        }
+        // Levenberg's damping, the same on every axis: the normal matrix is singular
+        // in the direction of the application point, which adds no torque
+        const f damping = lambda * (columns[0][0] + columns[1][1] + columns[2][2]) / 3.0;
+        for (int i = 0; i < 3; ++i)
+        {
+            columns[i][i] += damping;
+        }
+
+        const f3 c12 = cross(columns[1], columns[2]);
+        const f det = dot(columns[0], c12);
+        if (!(std::abs(det) > 0.0))
+        {
+            return f3();
+        }
+        return f3(dot(gradient, c12), dot(gradient, cross(columns[2], columns[0])), dot(gradient, cross(columns[0], columns[1]))) * (-1.0 / det);
+    }
+};
+
+// SimulateBatch of contexts spread over the scheduler, targets_per_job targets per job
+void simulateAll(std::span<const PreparedContext> contexts, std::span<f3x3> orientations, unsigned threads)
+{
+    const size_t bodiesPerJob = targets_per_job * evaluation_bodies;
+    const size_t jobs = (contexts.size() + bodiesPerJob - 1) / bodiesPerJob;
+    std::vector<double> costs(jobs);
+    for (size_t job = 0; job < jobs; ++job)
+    {
+        const size_t end = std::min(contexts.size(), (job + 1) * bodiesPerJob);
+        for (size_t i = job * bodiesPerJob; i < end; ++i)
+        {
+            costs[job] += contexts[i].final_time;
+        }
+    }
+
+    RunScheduled(costs, [&](size_t job)
+    {
+        const size_t first = job * bodiesPerJob;
+        const size_t count = std::min(contexts.size() - first, bodiesPerJob);
+        SimulateBatch<f>(contexts.subspan(first, count), orientations.subspan(first, count));
+    }, threads);
+}
+
+} // namespace anonymous
+
+std::vector<ShootingResult> SolveShooting(std::span<const ShootingTarget> targets, f tolerance, int maxIterations, unsigned threads)
+{
+    if (!(tolerance > 0.0))
+    {
+        throw std::runtime_error("SolveShooting: tolerance must be positive!");
+    }
+
+    std::vector<Shooter> shooters(targets.size());
+    for (size_t t = 0; t < targets.size(); ++t)
+    {
+        const SimulationContext& context = targets[t].context;
+        Shooter& shooter = shooters[t];
+        shooter.prepared = PreparedContext(context);
+        shooter.invInertia = context.ComputeInvInertiaTensor();
+        shooter.point = context.initial_impulse_application_point;
+        shooter.candidate = context.initial_impulse;
+        shooter.cost = std::numeric_limits<f>::infinity();
+    }
+
+    // The same buffers every iteration, compacted to the targets still running
+    std::vector<PreparedContext> contexts;
+    std::vector<f3x3> orientations;
+    std::vector<size_t> running;
+
+    for (int iteration = 0; ; ++iteration)
+    {
+        running.clear();
+        for (size_t t = 0; t < shooters.size(); ++t)
+        {
+            if (shooters[t].active)
+            {
+                running.push_back(t);
+            }
+        }
+        if (running.empty())
+        {
+            break;
+        }
+
+        contexts.resize(running.size() * evaluation_bodies);
+        orientations.resize(contexts.size());
+        for (size_t r = 0; r < running.size(); ++r)
+        {
+            shooters[running[r]].prepare(&contexts[r * evaluation_bodies]);
+        }
+
+        simulateAll(contexts, orientations, threads);
+
+        for (size_t r = 0; r < running.size(); ++r)
+        {
+            Shooter& shooter = shooters[running[r]];
+            const bool accepted = shooter.update(&orientations[r * evaluation_bodies], targets[running[r]].orientation);
+            // The first evaluation is the initial guess, not an iteration
+            shooter.result.iterations = iteration;
+
+            if (std::sqrt(shooter.cost) <= tolerance)
+            {
+                shooter.result.converged = true;
+                shooter.active = false;
+                continue;
+            }
+            if (iteration >= maxIterations || shooter.lambda > 1e16)
+            {
+                shooter.active = false;
+                continue;
+            }
+
+            const f3 delta = shooter.solve();
+            // Stalled: the step no longer moves the impulse in double precision
+            if (accepted && delta.norm() <= 1e-15 * std::max(shooter.impulse.norm(), f(1.0)))
+            {
+                shooter.active = false;
+                continue;
+            }
+            shooter.candidate = shooter.impulse + delta;
+        }
+    }
+
+    std::vector<ShootingResult> results(targets.size());
+    for (size_t t = 0; t < targets.size(); ++t)
+    {
+        const Shooter& shooter = shooters[t];
+        results[t] = shooter.result;
+        results[t].impulse = shooter.impulse;
+        results[t].orientation = shooter.orientation;
+        results[t].residual = std::sqrt(shooter.cost);
+    }
+    return results;
+}
+
+} // namespace REC991
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+// Thin lane-pack wrappers used by the batch engine. The kernels are written once
+// against pack<T, N> and instantiated with the widest width available, falling back
+// to one lane. That is the ISA of the translation unit (-mavx512f / -mavx2), or the one
+// kernels_*.cpp request for the #pragma GCC target(REC991_SIMD_TARGET) region of
+// kernels.inl with REC991_SIMD_AVX512 / REC991_SIMD_AVX2 / REC991_SIMD_FMA, as the
+// preprocessor does not see the macros of the pragma. Everything lives in an inline
+// namespace named after that ISA, so the code built for different ISA levels never
+// shares a symbol.
+#if defined(__AVX512F__) && !defined(REC991_SIMD_AVX512)
+#define REC991_SIMD_AVX512
+#endif
+#if defined(__AVX2__) && !defined(REC991_SIMD_AVX2)
+#define REC991_SIMD_AVX2
+#endif
+#if defined(__FMA__) && !defined(REC991_SIMD_FMA)
+#define REC991_SIMD_FMA
+#endif
+
+#if defined(REC991_SIMD_AVX2) || defined(REC991_SIMD_AVX512)
+#include <immintrin.h>
+#endif
+
+// In-class friends do not pick up #pragma GCC target (GCC 12), they spell it out
+#if defined(REC991_SIMD_TARGET)
+#define REC991_SIMD_FRIEND friend __attribute__((target(REC991_SIMD_TARGET)))
+#else
+#define REC991_SIMD_FRIEND friend
+#endif
+
+#if defined(REC991_SIMD_AVX512)
+#define REC991_SIMD_ISA isa_avx512
+#elif defined(REC991_SIMD_AVX2) && defined(REC991_SIMD_FMA)
+#define REC991_SIMD_ISA isa_avx2_fma
+#elif defined(REC991_SIMD_AVX2)
+#define REC991_SIMD_ISA isa_avx2
+#else
+#define REC991_SIMD_ISA isa_scalar
+#endif
+
+namespace REC991::simd
+{
+inline namespace REC991_SIMD_ISA
+{
+
+template<class T, int N>
+struct pack;
+
+// Scalar fallback, one lane
+template<>
+struct pack<double, 1>
+{
+    using scalar = double;
+    using mask = bool;
+    static constexpr int lanes = 1;
+
+    double v;
+
+    pack() : v(0.0) {}
+    pack(double s) : v(s) {}
+
+    static pack load(const double* p) { return pack(*p); }
+    void store(double* p) const { *p = v; }
+
+    REC991_SIMD_FRIEND pack operator+(pack a, pack b) { return a.v + b.v; }
+    REC991_SIMD_FRIEND pack operator-(pack a, pack b) { return a.v - b.v; }
+    REC991_SIMD_FRIEND pack operator*(pack a, pack b) { return a.v * b.v; }
+    REC991_SIMD_FRIEND pack operator/(pack a, pack b) { return a.v / b.v; }
+    pack operator-() const { return -v; }
+
+    REC991_SIMD_FRIEND mask operator<(pack a, pack b) { return a.v < b.v; }
+    REC991_SIMD_FRIEND mask operator>(pack a, pack b) { return a.v > b.v; }
+    REC991_SIMD_FRIEND mask operator==(pack a, pack b) { return a.v == b.v; }
+
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return a.v * b.v + c.v; }
+    REC991_SIMD_FRIEND pack sqrt(pack a) { return std::sqrt(a.v); }
+    REC991_SIMD_FRIEND pack round(pack a) { return std::nearbyint(a.v); }
+    REC991_SIMD_FRIEND pack floor(pack a) { return std::floor(a.v); }
+    REC991_SIMD_FRIEND pack select(mask m, pack a, pack b) { return m ? a : b; }
+    static mask mask_or(mask a, mask b) { return a || b; }
+    static bool any(mask m) { return m; }
+};
+
+template<>
+struct pack<float, 1>
+{
+    using scalar = float;
+    using mask = bool;
+    static constexpr int lanes = 1;
+
+    float v;
+
+    pack() : v(0.0f) {}
+    pack(float s) : v(s) {}
+
+    static pack load(const float* p) { return pack(*p); }
+    void store(float* p) const { *p = v; }
+
+    REC991_SIMD_FRIEND pack operator+(pack a, pack b) { return a.v + b.v; }
+    REC991_SIMD_FRIEND pack operator-(pack a, pack b) { return a.v - b.v; }
+    REC991_SIMD_FRIEND pack operator*(pack a, pack b) { return a.v * b.v; }
+    REC991_SIMD_FRIEND pack operator/(pack a, pack b) { return a.v / b.v; }
+    pack operator-() const { return -v; }
+
+    REC991_SIMD_FRIEND mask operator<(pack a, pack b) { return a.v < b.v; }
+    REC991_SIMD_FRIEND mask operator>(pack a, pack b) { return a.v > b.v; }
+    REC991_SIMD_FRIEND mask operator==(pack a, pack b) { return a.v == b.v; }
+
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return a.v * b.v + c.v; }
+    REC991_SIMD_FRIEND pack sqrt(pack a) { return std::sqrt(a.v); }
+    REC991_SIMD_FRIEND pack round(pack a) { return std::nearbyint(a.v); }
+    REC991_SIMD_FRIEND pack floor(pack a) { return std::floor(a.v); }
+    REC991_SIMD_FRIEND pack select(mask m, pack a, pack b) { return m ? a : b; }
+    static mask mask_or(mask a, mask b) { return a || b; }
+    static bool any(mask m) { return m; }
+};
+
+#if defined(REC991_SIMD_AVX2)
+template<>
+struct pack<double, 4>
+{
+    using scalar = double;
+    using mask = __m256d;
+    static constexpr int lanes = 4;
+
+    __m256d v;
+
+    pack() : v(_mm256_setzero_pd()) {}
+    pack(double s) : v(_mm256_set1_pd(s)) {}
+    pack(__m256d r) : v(r) {}
+
+    static pack load(const double* p) { return _mm256_loadu_pd(p); }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+    REC991_SIMD_FRIEND pack operator+(pack a, pack b) { return _mm256_add_pd(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator-(pack a, pack b) { return _mm256_sub_pd(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator*(pack a, pack b) { return _mm256_mul_pd(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator/(pack a, pack b) { return _mm256_div_pd(a.v, b.v); }
+    pack operator-() const { return _mm256_xor_pd(v, _mm256_set1_pd(-0.0)); }
+
+    REC991_SIMD_FRIEND mask operator<(pack a, pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+    REC991_SIMD_FRIEND mask operator>(pack a, pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+    REC991_SIMD_FRIEND mask operator==(pack a, pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ); }
+
+#if defined(REC991_SIMD_FMA)
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return _mm256_fmadd_pd(a.v, b.v, c.v); }
+#else
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return a * b + c; }
+#endif
+    REC991_SIMD_FRIEND pack sqrt(pack a) { return _mm256_sqrt_pd(a.v); }
+    REC991_SIMD_FRIEND pack round(pack a) { return _mm256_round_pd(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    REC991_SIMD_FRIEND pack floor(pack a) { return _mm256_floor_pd(a.v); }
+    REC991_SIMD_FRIEND pack select(mask m, pack a, pack b) { return _mm256_blendv_pd(b.v, a.v, m); }
+    static mask mask_or(mask a, mask b) { return _mm256_or_pd(a, b); }
+    static bool any(mask m) { return _mm256_movemask_pd(m) != 0; }
+};
+
+template<>
+struct pack<float, 8>
+{
+    using scalar = float;
+    using mask = __m256;
+    static constexpr int lanes = 8;
+
+    __m256 v;
+
+    pack() : v(_mm256_setzero_ps()) {}
+    pack(float s) : v(_mm256_set1_ps(s)) {}
+    pack(__m256 r) : v(r) {}
+
+    static pack load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+    REC991_SIMD_FRIEND pack operator+(pack a, pack b) { return _mm256_add_ps(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator-(pack a, pack b) { return _mm256_sub_ps(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator*(pack a, pack b) { return _mm256_mul_ps(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator/(pack a, pack b) { return _mm256_div_ps(a.v, b.v); }
+    pack operator-() const { return _mm256_xor_ps(v, _mm256_set1_ps(-0.0f)); }
+
+    REC991_SIMD_FRIEND mask operator<(pack a, pack b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    REC991_SIMD_FRIEND mask operator>(pack a, pack b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    REC991_SIMD_FRIEND mask operator==(pack a, pack b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+
+#if defined(REC991_SIMD_FMA)
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+#else
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return a * b + c; }
+#endif
+    REC991_SIMD_FRIEND pack sqrt(pack a) { return _mm256_sqrt_ps(a.v); }
+    REC991_SIMD_FRIEND pack round(pack a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    REC991_SIMD_FRIEND pack floor(pack a) { return _mm256_floor_ps(a.v); }
+    REC991_SIMD_FRIEND pack select(mask m, pack a, pack b) { return _mm256_blendv_ps(b.v, a.v, m); }
+    static mask mask_or(mask a, mask b) { return _mm256_or_ps(a, b); }
+    static bool any(mask m) { return _mm256_movemask_ps(m) != 0; }
+};
+#endif
+
+#if defined(REC991_SIMD_AVX512)
+// The rounding and square root intrinsics pass _mm512_undefined_pd/ps as the masked-off
+// source, a self-initialized variable GCC 12 reports as maybe uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template<>
+struct pack<double, 8>
+{
+    using scalar = double;
+    using mask = __mmask8;
+    static constexpr int lanes = 8;
+
+    __m512d v;
+
+    pack() : v(_mm512_setzero_pd()) {}
+    pack(double s) : v(_mm512_set1_pd(s)) {}
+    pack(__m512d r) : v(r) {}
+
+    static pack load(const double* p) { return _mm512_loadu_pd(p); }
+    void store(double* p) const { _mm512_storeu_pd(p, v); }
+
+    REC991_SIMD_FRIEND pack operator+(pack a, pack b) { return _mm512_add_pd(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator-(pack a, pack b) { return _mm512_sub_pd(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator*(pack a, pack b) { return _mm512_mul_pd(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator/(pack a, pack b) { return _mm512_div_pd(a.v, b.v); }
+    pack operator-() const { return _mm512_sub_pd(_mm512_setzero_pd(), v); }
+
+    REC991_SIMD_FRIEND mask operator<(pack a, pack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+    REC991_SIMD_FRIEND mask operator>(pack a, pack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_GT_OQ); }
+    REC991_SIMD_FRIEND mask operator==(pack a, pack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_EQ_OQ); }
+
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return _mm512_fmadd_pd(a.v, b.v, c.v); }
+    REC991_SIMD_FRIEND pack sqrt(pack a) { return _mm512_sqrt_pd(a.v); }
+    REC991_SIMD_FRIEND pack round(pack a) { return _mm512_roundscale_pd(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    REC991_SIMD_FRIEND pack floor(pack a) { return _mm512_roundscale_pd(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    REC991_SIMD_FRIEND pack select(mask m, pack a, pack b) { return _mm512_mask_blend_pd(m, b.v, a.v); }
+    static mask mask_or(mask a, mask b) { return static_cast<mask>(a | b); }
+    static bool any(mask m) { return m != 0; }
+};
+
+template<>
+struct pack<float, 16>
+{
+    using scalar = float;
+    using mask = __mmask16;
+    static constexpr int lanes = 16;
+
+    __m512 v;
+
+    pack() : v(_mm512_setzero_ps()) {}
+    pack(float s) : v(_mm512_set1_ps(s)) {}
+    pack(__m512 r) : v(r) {}
+
+    static pack load(const float* p) { return _mm512_loadu_ps(p); }
+    void store(float* p) const { _mm512_storeu_ps(p, v); }
+
+    REC991_SIMD_FRIEND pack operator+(pack a, pack b) { return _mm512_add_ps(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator-(pack a, pack b) { return _mm512_sub_ps(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator*(pack a, pack b) { return _mm512_mul_ps(a.v, b.v); }
+    REC991_SIMD_FRIEND pack operator/(pack a, pack b) { return _mm512_div_ps(a.v, b.v); }
+    pack operator-() const { return _mm512_sub_ps(_mm512_setzero_ps(), v); }
+
+    REC991_SIMD_FRIEND mask operator<(pack a, pack b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+    REC991_SIMD_FRIEND mask operator>(pack a, pack b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+    REC991_SIMD_FRIEND mask operator==(pack a, pack b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ); }
+
+    REC991_SIMD_FRIEND pack fmadd(pack a, pack b, pack c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+    REC991_SIMD_FRIEND pack sqrt(pack a) { return _mm512_sqrt_ps(a.v); }
+    REC991_SIMD_FRIEND pack round(pack a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    REC991_SIMD_FRIEND pack floor(pack a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    REC991_SIMD_FRIEND pack select(mask m, pack a, pack b) { return _mm512_mask_blend_ps(m, b.v, a.v); }
+    static mask mask_or(mask a, mask b) { return static_cast<mask>(a | b); }
+    static bool any(mask m) { return m != 0; }
+};
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// Widest pack of T the build enables: one 512-bit or 256-bit register, or one lane
+#if defined(REC991_SIMD_AVX512)
+template<class T>
+static constexpr int native_lanes = 64 / sizeof(T);
+#elif defined(REC991_SIMD_AVX2)
+template<class T>
+static constexpr int native_lanes = 32 / sizeof(T);
+#else
+template<class T>
+static constexpr int native_lanes = 1;
+#endif
+
+template<class T>
+using native = pack<T, native_lanes<T>>;
+
+using native_double = native<double>;
+using native_float = native<float>;
+
+// sin and cos of every lane (Cody-Waite reduction by pi/2, cephes minimax
+// polynomials on [-pi/4, pi/4]). Accurate to a couple of ulps for |x| < 1e8 in
+// double and |x| < 1e4 in float.
+template<class V>
+inline void sincos(V x, V& outSin, V& outCos)
+{
+    V s, c, q;
+    if constexpr (std::is_same_v<typename V::scalar, float>)
+    {
+        q = round(x * V(0.636619772367581343f));
+        V r = fmadd(q, V(-1.5703125f), x);
+        r = fmadd(q, V(-4.837512969970703125e-4f), r);
+        r = fmadd(q, V(-7.54978995489188216e-8f), r);
+
+        const V z = r * r;
+        V ps = V(-1.9515295891e-4f);
+        ps = fmadd(ps, z, V(8.3321608736e-3f));
+        ps = fmadd(ps, z, V(-1.6666654611e-1f));
+        s = fmadd(ps * z, r, r);
+
+        V pc = V(2.443315711809948e-5f);
+        pc = fmadd(pc, z, V(-1.388731625493765e-3f));
+        pc = fmadd(pc, z, V(4.166664568298827e-2f));
+        c = fmadd(pc * z, z, fmadd(V(-0.5f), z, V(1.0f)));
+    }
+    else
+    {
+        q = round(x * V(0.63661977236758134308));
+        V r = fmadd(q, V(-1.57079625129699707031e+00), x);
+        r = fmadd(q, V(-7.54978941586159635335e-08), r);
+        r = fmadd(q, V(-5.39030285815811905290e-15), r);
+
+        const V z = r * r;
+        V ps = V(1.58962301576546568060e-10);
+        ps = fmadd(ps, z, V(-2.50507477628578072866e-08));
+        ps = fmadd(ps, z, V(2.75573136213857245213e-06));
+        ps = fmadd(ps, z, V(-1.98412698295895385996e-04));
+        ps = fmadd(ps, z, V(8.33333333332211858878e-03));
+        ps = fmadd(ps, z, V(-1.66666666666666307295e-01));
+        s = fmadd(ps * z, r, r);
+
+        V pc = V(-1.13585365213876817300e-11);
+        pc = fmadd(pc, z, V(2.08757008419747316778e-09));
+        pc = fmadd(pc, z, V(-2.75573141792967388112e-07));
+        pc = fmadd(pc, z, V(2.48015872888517045348e-05));
+        pc = fmadd(pc, z, V(-1.38888888888730564116e-03));
+        pc = fmadd(pc, z, V(4.16666666666665929218e-02));
+        c = fmadd(pc * z, z, fmadd(V(-0.5), z, V(1.0)));
+    }
+
+    // quadrant = q mod 4, kept in floating point to avoid integer lanes
+    const V quadrant = q - V(4.0) * floor(q * V(0.25));
+    const auto swap = V::mask_or(quadrant == V(1.0), quadrant == V(3.0));
+    const V sinBase = select(swap, c, s);
+    const V cosBase = select(swap, s, c);
+    outSin = select(V::mask_or(quadrant == V(2.0), quadrant == V(3.0)), -sinBase, sinBase);
+    outCos = select(V::mask_or(quadrant == V(1.0), quadrant == V(2.0)), -cosBase, cosBase);
+}
+
+} // inline namespace REC991_SIMD_ISA
+} // namespace REC991::simd
+
+#undef REC991_SIMD_ISA
+#undef REC991_SIMD_FRIEND
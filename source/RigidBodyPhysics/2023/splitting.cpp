@@ -0,0 +1,63 @@
+#include "REC991.h"
+#include "splitting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+template<class Composition>
+SplittingResult SimulateSplitting(SimulationContext const& context, f timeStep)
+{
+    if (!(timeStep > 0.0))
+    {
+        throw std::runtime_error("Splitting time step must be positive!");
+    }
+
+    const f final_time = context.final_time;
+    const DiagonalMatrix3 I = context.ComputeInertiaTensor();
+    const DiagonalMatrix3 invI = context.ComputeInvInertiaTensor();
+    const splitting::FreeRotor<f> rotor(I.d);
+
+    f3 body_angular_momentum = rotor.inertia * context.ComputeInitialAngularVelocity(invI);
+    quat orientation;
+
+    const f initialEnergy = rotor.energy(body_angular_momentum);
+    SplittingResult result{};
+
+    const int required_steps = static_cast<int>(std::floor(final_time / timeStep));
+    for (int step = 0; step < required_steps; ++step)
+    {
+        rotor.step<Composition>(orientation, body_angular_momentum, timeStep);
+        result.max_energy_error = std::max(result.max_energy_error, std::abs(rotor.energy(body_angular_momentum) - initialEnergy));
+
+        if (step % 100 == 0)
+        {
+            orientation.normalize();
+        }
+    }
+
+    const f lastStep = final_time - f(required_steps * timeStep);
+    if (lastStep > 0.0)
+    {
+        rotor.step<Composition>(orientation, body_angular_momentum, lastStep);
+    }
+    rotor.casimirFlow(orientation, body_angular_momentum, final_time);
+
+    if (initialEnergy > 0.0)
+    {
+        result.max_energy_error /= initialEnergy;
+    }
+    result.orientation = quaternionToMatrix(orientation.normalized());
+    return result;
+}
+
+template SplittingResult SimulateSplitting<splitting::Strang2>(SimulationContext const& context, f timeStep);
+template SplittingResult SimulateSplitting<splitting::Yoshida4>(SimulationContext const& context, f timeStep);
+template SplittingResult SimulateSplitting<splitting::Suzuki4>(SimulationContext const& context, f timeStep);
+template SplittingResult SimulateSplitting<splitting::Yoshida6>(SimulationContext const& context, f timeStep);
+
+} // namespace REC991
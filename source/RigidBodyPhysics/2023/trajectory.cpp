@@ -0,0 +1,256 @@
+#include "REC991.h"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <stdexcept>
+
+namespace REC991
+{
+using namespace rigidbody;
+
+namespace
+{
+// Cubic Hermite basis on [0, 1]: the weights of the start value, start derivative, end
+// value and end derivative
+struct HermiteWeights
+{
+    f h00, h10, h01, h11;
+
+    explicit HermiteWeights(f s)
+    {
+        const f s2 = s * s;
+        const f s3 = s2 * s;
+        h00 = 2.0 * s3 - 3.0 * s2 + 1.0;
+        h10 = s3 - 2.0 * s2 + s;
+        h01 = -2.0 * s3 + 3.0 * s2;
+        h11 = s3 - s2;
+    }
+};
+
+// One step of the integration, from (q0, w0) to (q1, w1) over dt, and what its
+// interpolant needs, computed on the first sample that falls in it
+struct StepInterpolant
+{
+    quat q0;
+    f3 w0, w1;
+    f3 dw0, dw1;   // dt * w' at both ends, from Euler's equations
+    f3 xi1;        // rotation vector of q0^-1 q1
+    f3 dxi1;       // dt * xi'(1)
+
+    StepInterpolant(const quat& q0, const quat& q1, const f3& w0, const f3& w1, const f3& eulerMotionVector, f dt)
+        : q0(q0), w0(w0), w1(w1)
+    {
+        dw0 = dt * quat::ComputeAngularAcceleration(eulerMotionVector, w0);
+        dw1 = dt * quat::ComputeAngularAcceleration(eulerMotionVector, w1);
+        xi1 = logmap(q0.conjugate() * q1);
+        dxi1 = dt * dexpinv(xi1, w1);
+    }
+
+    // xi(0) = 0 and xi'(0) = dt * dexpinv(0, w0) = dt * w0
+    TrajectorySample at(f s, f dt) const
+    {
+        const HermiteWeights h(s);
+        const f3 xi = (h.h10 * dt) * w0 + h.h01 * xi1 + h.h11 * dxi1;
+        const quat orientation = (q0 * expmap(xi)).normalized();
+        return { RotationMatrix3(orientation), h.h00 * w0 + h.h10 * dw0 + h.h01 * w1 + h.h11 * dw1 };
+    }
+};
+
+// Runs the fixed step integration of prepared from rest at time 0 and calls
+// onStep(t0, h, q0, q1, w0, w1) after every step, while it returns true and until
+// endTime, the last step shortened to end on it. h is time_step but for that one.
+template<class Integrator, class OnStep>
+void integrateSteps(const PreparedContext& prepared, f endTime, OnStep&& onStep)
+{
+    const f3& eulerMotionVector = prepared.euler_motion_vector;
+    const integrators::InvariantManifold<f> manifold(prepared.inertia, prepared.angular_velocity);
+
+    // A local copy: the stores to the state could alias the global as far as the compiler knows
+    const f dt = time_step;
+
+    quat orientation;
+    f3 frame_angular_velocity = prepared.angular_velocity;
+    for (int step = 0; step * dt < endTime; ++step)
+    {
+        // Step start from the step index, not from accumulated dt, so the time does not drift
+        const f t0 = step * dt;
+        const f h = std::min(dt, endTime - t0);
+
+        quat nextOrientation = orientation;
+        f3 nextAngularVelocity = frame_angular_velocity;
+        integrators::step<Integrator>(nextOrientation, eulerMotionVector, nextAngularVelocity, h, manifold);
+
+        if (step % 100 == 0)
+        {
+            nextOrientation.normalize();
+        }
+
+        if (!onStep(t0, h, orientation, nextOrientation, frame_angular_velocity, nextAngularVelocity))
+        {
+            return;
+        }
+
+        orientation = nextOrientation;
+        frame_angular_velocity = nextAngularVelocity;
+    }
+}
+
+// Illinois variant of regula falsi on the step interpolant: the root of g(s) in [0, 1]
+// from g(0) = g0 and g(1) = g1 of opposite signs. When the same end is kept twice in
+// a row, its value is halved so both ends converge.
+template<class G>
+f findRoot(G&& g, f g0, f g1, f tolerance)
+{
+    f a = 0.0, b = 1.0;
+    f ga = g0, gb = g1;
+    int kept = 0; // +1: a was kept by the last iteration, -1: b was
+    for (int iteration = 0; iteration < 100 && b - a > tolerance; ++iteration)
+    {
+        const f s = std::clamp((a * gb - b * ga) / (gb - ga), a, b);
+        const f gs = g(s);
+        if (gs == 0.0)
+        {
+            return s;
+        }
+        if ((gs < 0.0) == (gb < 0.0))
+        {
+            b = s;
+            gb = gs;
+            if (kept == 1)
+            {
+                ga *= 0.5;
+            }
+            kept = 1;
+        }
+        else
+        {
+            a = s;
+            ga = gs;
+            if (kept == -1)
+            {
+                gb *= 0.5;
+            }
+            kept = -1;
+        }
+    }
+    return std::abs(ga) < std::abs(gb) ? a : b;
+}
+
+bool crosses(EventDirection direction, f g0, f g1)
+{
+    const bool rising = g0 < 0.0 && g1 >= 0.0;
+    const bool falling = g0 > 0.0 && g1 <= 0.0;
+    switch (direction)
+    {
+    case EventDirection::Rising:
+        return rising;
+    case EventDirection::Falling:
+        return falling;
+    default:
+        return rising || falling;
+    }
+}
+
+} // namespace anonymous
+
+template<class Integrator>
+std::vector<TrajectorySample> SimulateAt(SimulationContext const& context, std::span<const f> sortedTimes)
+{
+    for (size_t i = 0; i < sortedTimes.size(); ++i)
+    {
+        if (!(sortedTimes[i] >= 0.0) || !std::isfinite(sortedTimes[i]) || (i > 0 && sortedTimes[i] < sortedTimes[i - 1]))
+        {
+            throw std::runtime_error("SimulateAt: times must be finite, non-negative and sorted!");
+        }
+    }
+
+    const PreparedContext prepared(context);
+    std::vector<TrajectorySample> samples(sortedTimes.size());
+
+    // The samples at 0 are the initial state, the steps cover the others
+    size_t next = 0;
+    for (; next < sortedTimes.size() && sortedTimes[next] == 0.0; ++next)
+    {
+        samples[next] = { RotationMatrix3(quat()), prepared.angular_velocity };
+    }
+    if (next == sortedTimes.size())
+    {
+        return samples;
+    }
+
+    integrateSteps<Integrator>(prepared, sortedTimes.back(),
+        [&](f t0, f h, const quat& q0, const quat& q1, const f3& w0, const f3& w1)
+        {
+            const f t1 = t0 + h;
+            if (sortedTimes[next] <= t1)
+            {
+                const StepInterpolant interpolant(q0, q1, w0, w1, prepared.euler_motion_vector, h);
+                for (; next < sortedTimes.size() && sortedTimes[next] <= t1; ++next)
+                {
+                    samples[next] = interpolant.at(std::min((sortedTimes[next] - t0) / h, f(1.0)), h);
+                }
+            }
+            return next < sortedTimes.size();
+        });
+    return samples;
+}
+
+template<class Integrator>
+std::vector<Event> SimulateEvents(SimulationContext const& context, std::span<const EventDetector> detectors, f tolerance)
+{
+    if (!(tolerance > 0.0))
+    {
+        throw std::runtime_error("SimulateEvents: tolerance must be positive!");
+    }
+
+    const PreparedContext prepared(context);
+    std::vector<Event> events;
+
+    // Values at the start of the current step, so every state is evaluated once
+    std::vector<f> previous(detectors.size());
+    const TrajectorySample initial{ RotationMatrix3(quat()), prepared.angular_velocity };
+    for (size_t i = 0; i < detectors.size(); ++i)
+    {
+        previous[i] = detectors[i].function(initial);
+    }
+
+    integrateSteps<Integrator>(prepared, context.final_time,
+        [&](f t0, f h, const quat& q0, const quat& q1, const f3& w0, const f3& w1)
+        {
+            const TrajectorySample end{ RotationMatrix3(q1), w1 };
+            const size_t stepBegin = events.size();
+            std::optional<StepInterpolant> interpolant;
+            for (size_t i = 0; i < detectors.size(); ++i)
+            {
+                const f g1 = detectors[i].function(end);
+                if (crosses(detectors[i].direction, previous[i], g1))
+                {
+                    if (!interpolant)
+                    {
+                        interpolant.emplace(q0, q1, w0, w1, prepared.euler_motion_vector, h);
+                    }
+                    const auto g = [&](f s) { return detectors[i].function(interpolant->at(s, h)); };
+                    const f s = findRoot(g, previous[i], g1, tolerance / h);
+                    events.push_back({ i, t0 + s * h, interpolant->at(s, h), previous[i] < 0.0 });
+                }
+                previous[i] = g1;
+            }
+
+            // Several detectors can fire in one step
+            std::sort(events.begin() + stepBegin, events.end(),
+                      [](const Event& a, const Event& b) { return a.time < b.time; });
+            return true;
+        });
+    return events;
+}
+
+template std::vector<TrajectorySample> SimulateAt<integrators::CG3>(SimulationContext const& context, std::span<const f> sortedTimes);
+template std::vector<TrajectorySample> SimulateAt<integrators::CF4>(SimulationContext const& context, std::span<const f> sortedTimes);
+template std::vector<TrajectorySample> SimulateAt<integrators::RKMK4>(SimulationContext const& context, std::span<const f> sortedTimes);
+
+template std::vector<Event> SimulateEvents<integrators::CG3>(SimulationContext const& context, std::span<const EventDetector> detectors, f tolerance);
+template std::vector<Event> SimulateEvents<integrators::CF4>(SimulationContext const& context, std::span<const EventDetector> detectors, f tolerance);
+template std::vector<Event> SimulateEvents<integrators::RKMK4>(SimulationContext const& context, std::span<const EventDetector> detectors, f tolerance);
+
+} // namespace REC991
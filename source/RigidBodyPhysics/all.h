@@ -2,7 +2,14 @@
 #define ALL_H
 
 #include "2023/REC991.h"
+#include "2023/dispatch.h"
 #include "2023/draw.h"
+#include "2023/scheduler.h"
+#include "2023/simd.h"
+#include "dual.h"
+#include "extrapolation.h"
+#include "integrators.h"
 #include "physicshelper.h"
+#include "splitting.h"
 
 #endif
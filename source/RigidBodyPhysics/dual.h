@@ -0,0 +1,193 @@
+#pragma once
+
+#include "physicshelper.h"
+
+#include <cmath>
+
+namespace rigidbody
+{
+// Forward mode automatic differentiation: a scalar with the derivatives of its value
+// with respect to N inputs, so one run of the templated math types over Dual<f, N>
+// gives the value and the whole Jacobian column by column:
+//   BasicSimulationContext<Dual<f, 10>> context = ...; // inputs seeded with variable()
+// Constants convert implicitly with zero derivatives. Comparisons only look at the
+// value, so the branches of the math layer follow the undifferentiated run. The
+// functions below are found by argument dependent lookup, which is why the math layer
+// calls sqrt, sin, ... unqualified after a using std::sqrt, ...
+template<class T, int N>
+struct Dual
+{
+    using scalar = T;
+    static constexpr int size = N;
+
+    T value;
+    T tangent[N];
+
+    // Uninitialized like a T, so basic_f3 keeps its union
+    Dual() = default;
+
+    constexpr Dual(T value) : value(value), tangent{} {}
+
+    // Input number index: derivative 1 with respect to itself
+    static constexpr Dual variable(T value, int index)
+    {
+        Dual d(value);
+        d.tangent[index] = T(1.0);
+        return d;
+    }
+
+    // The result of a function with value and derivative at x, by the chain rule
+    static constexpr Dual chain(T value, T derivative, const Dual& x)
+    {
+        Dual d;
+        d.value = value;
+        for (int i = 0; i < N; ++i)
+        {
+            d.tangent[i] = derivative * x.tangent[i];
+        }
+        return d;
+    }
+
+    constexpr Dual operator-() const
+    {
+        return chain(-value, T(-1.0), *this);
+    }
+
+    friend constexpr Dual operator+(const Dual& a, const Dual& b)
+    {
+        Dual d;
+        d.value = a.value + b.value;
+        for (int i = 0; i < N; ++i)
+        {
+            d.tangent[i] = a.tangent[i] + b.tangent[i];
+        }
+        return d;
+    }
+
+    friend constexpr Dual operator-(const Dual& a, const Dual& b)
+    {
+        Dual d;
+        d.value = a.value - b.value;
+        for (int i = 0; i < N; ++i)
+        {
+            d.tangent[i] = a.tangent[i] - b.tangent[i];
+        }
+        return d;
+    }
+
+    friend constexpr Dual operator*(const Dual& a, const Dual& b)
+    {
+        Dual d;
+        d.value = a.value * b.value;
+        for (int i = 0; i < N; ++i)
+        {
+            d.tangent[i] = a.tangent[i] * b.value + a.value * b.tangent[i];
+        }
+        return d;
+    }
+
+    friend constexpr Dual operator/(const Dual& a, const Dual& b)
+    {
+        checkDivisor(b.value);
+        const T inverse = T(1.0) / b.value;
+        Dual d;
+        d.value = a.value * inverse;
+        for (int i = 0; i < N; ++i)
+        {
+            d.tangent[i] = (a.tangent[i] - d.value * b.tangent[i]) * inverse;
+        }
+        return d;
+    }
+
+    // Constant operands skip the products with zero derivatives
+    friend constexpr Dual operator+(const Dual& a, T b)
+    {
+        Dual d = a;
+        d.value += b;
+        return d;
+    }
+    friend constexpr Dual operator+(T a, const Dual& b) { return b + a; }
+    friend constexpr Dual operator-(const Dual& a, T b) { return a + (-b); }
+    friend constexpr Dual operator-(T a, const Dual& b) { return -b + a; }
+    friend constexpr Dual operator*(const Dual& a, T b) { return chain(a.value * b, b, a); }
+    friend constexpr Dual operator*(T a, const Dual& b) { return b * a; }
+    friend constexpr Dual operator/(const Dual& a, T b)
+    {
+        checkDivisor(b);
+        return a * (T(1.0) / b);
+    }
+    friend constexpr Dual operator/(T a, const Dual& b)
+    {
+        checkDivisor(b.value);
+        const T value = a / b.value;
+        return chain(value, -value / b.value, b);
+    }
+
+    constexpr Dual& operator+=(const Dual& b) { return *this = *this + b; }
+    constexpr Dual& operator-=(const Dual& b) { return *this = *this - b; }
+    constexpr Dual& operator*=(const Dual& b) { return *this = *this * b; }
+    constexpr Dual& operator/=(const Dual& b) { return *this = *this / b; }
+
+    friend constexpr bool operator==(const Dual& a, const Dual& b) { return a.value == b.value; }
+    friend constexpr auto operator<=>(const Dual& a, const Dual& b) { return a.value <=> b.value; }
+};
+
+template<class T, int N>
+constexpr Dual<T, N> sqrt(const Dual<T, N>& x)
+{
+    using std::sqrt;
+    const T root = sqrt(x.value);
+    return Dual<T, N>::chain(root, T(0.5) / root, x);
+}
+
+template<class T, int N>
+constexpr Dual<T, N> sin(const Dual<T, N>& x)
+{
+    using std::sin, std::cos;
+    return Dual<T, N>::chain(sin(x.value), cos(x.value), x);
+}
+
+template<class T, int N>
+constexpr Dual<T, N> cos(const Dual<T, N>& x)
+{
+    using std::sin, std::cos;
+    return Dual<T, N>::chain(cos(x.value), -sin(x.value), x);
+}
+
+template<class T, int N>
+constexpr Dual<T, N> tan(const Dual<T, N>& x)
+{
+    using std::tan;
+    const T t = tan(x.value);
+    return Dual<T, N>::chain(t, T(1.0) + t * t, x);
+}
+
+// d atan2(y, x) = (x dy - y dx) / (x^2 + y^2)
+template<class T, int N>
+constexpr Dual<T, N> atan2(const Dual<T, N>& y, const Dual<T, N>& x)
+{
+    using std::atan2;
+    const T inverse = T(1.0) / (x.value * x.value + y.value * y.value);
+    Dual<T, N> d;
+    d.value = atan2(y.value, x.value);
+    for (int i = 0; i < N; ++i)
+    {
+        d.tangent[i] = (x.value * y.tangent[i] - y.value * x.tangent[i]) * inverse;
+    }
+    return d;
+}
+
+template<class T, int N>
+constexpr Dual<T, N> abs(const Dual<T, N>& x)
+{
+    return x.value < T(0.0) ? -x : x;
+}
+
+template<class T, int N>
+constexpr bool isfinite(const Dual<T, N>& x)
+{
+    using std::isfinite;
+    return isfinite(x.value);
+}
+
+} // namespace rigidbody
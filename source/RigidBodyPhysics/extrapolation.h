@@ -0,0 +1,157 @@
+#pragma once
+
+#include "physicshelper.h"
+#include "integrators.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace rigidbody
+{
+namespace extrapolation
+{
+// Extrapolation of one of the integrators.h policies over a macro step H. Column j
+// runs the policy with n_j = j + 1 sub-steps of H / n_j (harmonic sequence) and the
+// extrapolation to a zero sub-step is a fixed linear combination of the columns. The
+// policies are not symmetric, so their error expands in every power h^p, h^(p+1), ...
+// of the sub-step: with the harmonic sequence that is not a polynomial in one power
+// of h and the Aitken-Neville recursion does not apply, the weights come from
+//   sum_i w_i = 1,  sum_i w_i n_i^-k = 0 for k = p, ..., p + j - 1
+// instead. Orientations are extrapolated in the exponential coordinates around the
+// first column, which keeps the result on SO(3); angular velocities live in a vector
+// space.
+
+static constexpr int max_columns = 10;
+
+// weights[j][i]: weight of column i in the extrapolation of columns 0 to j
+template<int order>
+struct Weights
+{
+    using Table = std::array<std::array<double, max_columns>, max_columns>;
+
+    static constexpr Table compute()
+    {
+        Table weights{};
+        for (int j = 0; j < max_columns; ++j)
+        {
+            const int size = j + 1;
+            double system[max_columns][max_columns + 1]{};
+            for (int i = 0; i < size; ++i)
+            {
+                system[0][i] = 1.0;
+                double inversePower = 1.0;
+                for (int k = 1; k < order; ++k)
+                    inversePower /= i + 1;
+                for (int row = 1; row < size; ++row)
+                {
+                    inversePower /= i + 1;
+                    system[row][i] = inversePower;
+                }
+            }
+            system[0][size] = 1.0;
+
+            // Gaussian elimination with partial pivoting, every row has a largest entry of 1 (n_0 = 1)
+            for (int pivot = 0; pivot < size; ++pivot)
+            {
+                int best = pivot;
+                for (int row = pivot + 1; row < size; ++row)
+                    if ((system[row][pivot] < 0.0 ? -system[row][pivot] : system[row][pivot]) >
+                        (system[best][pivot] < 0.0 ? -system[best][pivot] : system[best][pivot]))
+                        best = row;
+                for (int column = 0; column <= size; ++column)
+                    std::swap(system[pivot][column], system[best][column]);
+                for (int row = pivot + 1; row < size; ++row)
+                {
+                    const double factor = system[row][pivot] / system[pivot][pivot];
+                    for (int column = pivot; column <= size; ++column)
+                        system[row][column] -= factor * system[pivot][column];
+                }
+            }
+            for (int i = size - 1; i >= 0; --i)
+            {
+                double value = system[i][size];
+                for (int column = i + 1; column < size; ++column)
+                    value -= system[i][column] * weights[j][column];
+                weights[j][i] = value / system[i][i];
+            }
+        }
+        return weights;
+    }
+
+    static constexpr Table table = compute();
+};
+
+// Column j: advances orientation and w by H in j + 1 sub-steps
+template<class Integrator, class T>
+void column(int j, basic_quat<T>& orientation, const basic_f3<T>& eulerMotionVector, basic_f3<T>& w, T H)
+{
+    const int substeps = j + 1;
+    const T h = H / T(substeps);
+    for (int substep = 0; substep < substeps; ++substep)
+    {
+        integrators::step<Integrator>(orientation, eulerMotionVector, w, h);
+    }
+}
+
+template<class Integrator, class T>
+class Tableau
+{
+public:
+    using f3 = basic_f3<T>;
+    using quat = basic_quat<T>;
+
+    explicit Tableau(T H) : m_H(H) {}
+
+    int size() const { return m_size; }
+
+    // Adds the next column and returns the error estimate of the extrapolated state:
+    // the difference with the extrapolation without that column, as a rotation angle
+    // (the angular velocity difference is taken over H). The first column has none.
+    T add(const quat& orientation, const f3& w)
+    {
+        static constexpr auto& weights = Weights<Integrator::order>::table;
+
+        const int j = m_size++;
+        if (j == 0)
+        {
+            m_base = orientation;
+        }
+        m_columnTheta[j] = logmap(m_base.conjugate() * orientation);
+        m_columnVelocity[j] = w;
+
+        const f3 previousTheta = m_theta;
+        const f3 previousVelocity = m_velocity;
+        m_theta = f3();
+        m_velocity = f3();
+        for (int i = 0; i <= j; ++i)
+        {
+            m_theta = m_theta + T(weights[j][i]) * m_columnTheta[i];
+            m_velocity = m_velocity + T(weights[j][i]) * m_columnVelocity[i];
+        }
+
+        if (j == 0)
+        {
+            return std::numeric_limits<T>::infinity();
+        }
+        return std::max((m_theta - previousTheta).norm(), m_H * (m_velocity - previousVelocity).norm());
+    }
+
+    quat orientation() const { return m_base * expmap(m_theta); }
+    f3 angularVelocity() const { return m_velocity; }
+
+private:
+    T m_H;
+    int m_size = 0;
+    quat m_base;
+    f3 m_columnTheta[max_columns];
+    f3 m_columnVelocity[max_columns];
+    // Extrapolation of the columns added so far
+    f3 m_theta;
+    f3 m_velocity;
+};
+
+} // namespace extrapolation
+} // namespace rigidbody
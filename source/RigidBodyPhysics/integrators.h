@@ -0,0 +1,426 @@
+#pragma once
+
+#include "physicshelper.h"
+
+#include <Helpers.h>
+
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace rigidbody
+{
+
+// Exponential map of so(3) as a unit quaternion: rotation of angle |theta| about theta
+template<class T>
+inline basic_quat<T> expmap(const basic_f3<T>& theta)
+{
+    using std::sin, std::cos;
+    const T angle = theta.norm();
+    if (angle == 0.0)
+    {
+        return basic_quat<T>();
+    }
+    return basic_quat<T>(cos(T(0.5) * angle), sin(T(0.5) * angle) / angle * theta);
+}
+
+// expmap without sqrt, division or libm call for the small angles of a time step, from
+// quat::halfRotationPolynomial. Larger angles go through sin and cos.
+template<class T>
+NERD_FORCEINLINE basic_quat<T> expmapPolynomial(const basic_f3<T>& theta)
+{
+    return basic_quat<T>::halfRotationPolynomial(T(0.5) * theta);
+}
+
+// Inverse of expmap on the rotations of angle below pi: the rotation vector of q, taking
+// the representative of q or -q with a non-negative scalar part
+template<class T>
+inline basic_f3<T> logmap(const basic_quat<T>& q)
+{
+    using std::atan2, std::abs;
+    const basic_f3<T> axis(q.x, q.y, q.z);
+    const T sine = axis.norm();
+    if (sine == 0.0)
+    {
+        return basic_f3<T>();
+    }
+    const T angle = T(2.0) * atan2(sine, abs(q.w));
+    return (q.w < 0.0 ? -angle : angle) / sine * axis;
+}
+
+// Inverse of the right trivialised differential of exp on so(3), such that
+// q = q0 * exp(theta) with theta' = dexpinv(theta, w) solves q' = q * w / 2
+template<class T>
+inline basic_f3<T> dexpinv(const basic_f3<T>& theta, const basic_f3<T>& w)
+{
+    // The closed form cancels catastrophically below about sqrt(epsilon), use the series there
+    constexpr T series_threshold = std::is_same_v<T, float> ? T(3e-4) : T(1e-8);
+    const T angle2 = dot(theta, theta);
+    T coeff;
+    if (angle2 < series_threshold)
+    {
+        coeff = T(1.0 / 12.0) + angle2 / T(720.0);
+    }
+    else
+    {
+        using std::sqrt, std::tan;
+        const T angle = sqrt(angle2);
+        coeff = (T(1.0) - T(0.5) * angle / tan(T(0.5) * angle)) / angle2;
+    }
+    const basic_f3<T> tw = cross(theta, w);
+    return w + T(0.5) * tw + coeff * cross(theta, tw);
+}
+
+// dexpinv without sqrt, division or tan, for theta.theta <= 4 * expmap_polynomial_range:
+// (1 - (x / 2) cot(x / 2)) / x^2 = sum_n (-1)^(n + 1) B_2n / (2n)! x^(2n - 2), truncated
+// where the next term is below half an ulp of T. Larger angles go through dexpinv.
+template<class T>
+NERD_FORCEINLINE basic_f3<T> dexpinvPolynomial(const basic_f3<T>& theta, const basic_f3<T>& w)
+{
+    static constexpr double coefficients[] = { 1.0 / 12.0, 1.0 / 720.0, 1.0 / 30240.0, 1.0 / 1209600.0,
+                                               1.0 / 47900160.0, 691.0 / 1307674368000.0, 1.0 / 74724249600.0 };
+    static constexpr int terms = std::is_same_v<T, float> ? 3 : 7;
+
+    const T angle2 = dot(theta, theta);
+    if (angle2 > T(4.0 * expmap_polynomial_range))
+    {
+        return dexpinv(theta, w);
+    }
+
+    T coeff = T(coefficients[terms - 1]);
+    for (int k = terms - 2; k >= 0; --k)
+    {
+        coeff = coeff * angle2 + T(coefficients[k]);
+    }
+    const basic_f3<T> tw = cross(theta, w);
+    return w + T(0.5) * tw + coeff * cross(theta, tw);
+}
+
+namespace integrators
+{
+// Geometric integrators for the orientation, selected at compile time.
+// Every policy integrates w with one RK4 step and reads w at its nodes c[] from the
+// continuous extension of that step (see quat::applyRotationStep), so the policies
+// only differ in how the node velocities are turned into a rotation:
+//  - CommutatorFree: q1 = q0 * exp(dt * sum_s beta[0][s] w_s) * exp(dt * sum_s beta[1][s] w_s) * ...
+//  - MuntheKaas: explicit Runge-Kutta on theta' = dexpinv(theta, w), q1 = q0 * exp(theta)
+// The commutator-free exponentials are built from the half rotation vectors
+// dt / 2 * sum_s beta[e][s] w_s, the 1/2 folded into the stage weights.
+enum class Family
+{
+    CommutatorFree,
+    MuntheKaas,
+};
+
+// Crouch-Grossman 3, the historical default, step for step quat::applyRotationStep: its
+// rotations always come from the polynomials of halfRotationPolynomial
+struct CG3
+{
+    static constexpr const char* name = "CG3";
+    static constexpr bool polynomial_exp = true;
+    static constexpr Family family = Family::CommutatorFree;
+    static constexpr int order = 3;
+    static constexpr int stages = 3;
+    static constexpr int exponentials = 3;
+    static constexpr f c[stages] = { 0.0, 3.0 / 4.0, 17.0 / 24.0 };
+    static constexpr f beta[exponentials][stages] = { { 13.0 / 51.0, 0.0, 0.0 },
+                                                      { 0.0, -2.0 / 3.0, 0.0 },
+                                                      { 0.0, 0.0, 24.0 / 17.0 } };
+};
+
+// Fourth order commutator-free method on the Gauss nodes (Blanes & Moan), two exponentials
+struct CF4
+{
+    static constexpr f sqrt3 = 1.7320508075688772935;
+    static constexpr f alpha1 = 0.25 + sqrt3 / 6.0;
+    static constexpr f alpha2 = 0.25 - sqrt3 / 6.0;
+
+    static constexpr const char* name = "CF4";
+    static constexpr Family family = Family::CommutatorFree;
+    static constexpr int order = 4;
+    static constexpr int stages = 2;
+    static constexpr int exponentials = 2;
+    static constexpr f c[stages] = { 0.5 - sqrt3 / 6.0, 0.5 + sqrt3 / 6.0 };
+    static constexpr f beta[exponentials][stages] = { { alpha1, alpha2 },
+                                                      { alpha2, alpha1 } };
+};
+
+// Runge-Kutta-Munthe-Kaas with the classical RK4 tableau
+struct RKMK4
+{
+    static constexpr const char* name = "RKMK4";
+    static constexpr Family family = Family::MuntheKaas;
+    static constexpr int order = 4;
+    static constexpr int stages = 4;
+    static constexpr f c[stages] = { 0.0, 0.5, 0.5, 1.0 };
+    static constexpr f a[stages][stages] = { { 0.0, 0.0, 0.0, 0.0 },
+                                             { 0.5, 0.0, 0.0, 0.0 },
+                                             { 0.0, 0.5, 0.0, 0.0 },
+                                             { 0.0, 0.0, 1.0, 0.0 } };
+    static constexpr f b[stages] = { 1.0 / 6.0, 1.0 / 3.0, 1.0 / 3.0, 1.0 / 6.0 };
+};
+
+// Policy adapter: the Base integrator with its rotations built by expmapPolynomial
+// instead of sin and cos, and dexpinvPolynomial for the Munthe-Kaas policies. Same
+// result to rounding at the time steps of Simulate. CG3 is already built that way.
+template<class Base>
+struct PolynomialExp : Base
+{
+    static constexpr bool polynomial_exp = true;
+};
+
+template<class Integrator>
+constexpr bool is_polynomial_exp = requires { Integrator::polynomial_exp; };
+
+namespace detail
+{
+template<class Integrator, class T>
+NERD_FORCEINLINE basic_quat<T> exponential(const basic_f3<T>& theta)
+{
+    if constexpr (is_polynomial_exp<Integrator>)
+    {
+        return expmapPolynomial(theta);
+    }
+    else
+    {
+        return expmap(theta);
+    }
+}
+
+// exponential of the rotation vector 2 * h
+template<class Integrator, class T>
+NERD_FORCEINLINE basic_quat<T> halfExponential(const basic_f3<T>& h)
+{
+    if constexpr (is_polynomial_exp<Integrator>)
+    {
+        return basic_quat<T>::halfRotationPolynomial(h);
+    }
+    else
+    {
+        return expmap(T(2.0) * h);
+    }
+}
+
+template<class Integrator, class T>
+NERD_FORCEINLINE basic_f3<T> inverseDifferential(const basic_f3<T>& theta, const basic_f3<T>& w)
+{
+    if constexpr (is_polynomial_exp<Integrator>)
+    {
+        return dexpinvPolynomial(theta, w);
+    }
+    else
+    {
+        return dexpinv(theta, w);
+    }
+}
+
+// Linear combination sum_s weights[s] * w(c[s] * dt) of the continuous extension,
+// expanded on w0 and the RK4 stages: sum * w0 + dt * (d1 * k1 + d23 * (k2 + k3) + d4 * k4)
+struct StageCombination
+{
+    f sum;
+    quat::DenseOutputWeights d;
+};
+
+template<const auto& weights, const auto& nodes>
+constexpr StageCombination ComputeStageCombination()
+{
+    StageCombination combination{ 0.0, { 0.0, 0.0, 0.0 } };
+    for (size_t s = 0; s < std::size(weights); ++s)
+    {
+        const quat::DenseOutputWeights d = quat::ComputeDenseOutputWeights(nodes[s]);
+        combination.sum += weights[s];
+        combination.d.d1 += weights[s] * d.d1;
+        combination.d.d23 += weights[s] * d.d23;
+        combination.d.d4 += weights[s] * d.d4;
+    }
+    return combination;
+}
+
+template<f weight, class T>
+NERD_FORCEINLINE void accumulate(basic_f3<T>& result, bool& empty, T scale, const basic_f3<T>& v)
+{
+    if constexpr (weight != 0.0)
+    {
+        result = empty ? (T(weight) * scale) * v : result + (T(weight) * scale) * v;
+        empty = false;
+    }
+}
+
+// RK4 stages of Euler's equations over one step, with their continuous extension
+template<class T>
+struct AngularVelocityStages
+{
+    using f3 = basic_f3<T>;
+
+    f3 w0, k1, k23, k4;
+
+    NERD_FORCEINLINE AngularVelocityStages(const f3& eulerMotionVector, const f3& w, T dt) : w0(w)
+    {
+        k1 = basic_quat<T>::ComputeAngularAcceleration(eulerMotionVector, w);
+        const f3 k2 = basic_quat<T>::ComputeAngularAcceleration(eulerMotionVector, w + T(0.5) * dt * k1);
+        const f3 k3 = basic_quat<T>::ComputeAngularAcceleration(eulerMotionVector, w + T(0.5) * dt * k2);
+        k4 = basic_quat<T>::ComputeAngularAcceleration(eulerMotionVector, w + dt * k3);
+        k23 = k2 + k3;
+    }
+
+    // scale * sum_s weights[s] * w(nodes[s] * dt), with the coefficients folded at compile time
+    template<const auto& weights, const auto& nodes>
+    NERD_FORCEINLINE f3 combination(T dt, T scale) const
+    {
+        static constexpr StageCombination c = ComputeStageCombination<weights, nodes>();
+        f3 result;
+        bool empty = true;
+        accumulate<c.sum>(result, empty, scale, w0);
+        accumulate<c.d.d1>(result, empty, scale * dt, k1);
+        accumulate<c.d.d23>(result, empty, scale * dt, k23);
+        accumulate<c.d.d4>(result, empty, scale * dt, k4);
+        return result;
+    }
+
+    template<f s>
+    NERD_FORCEINLINE f3 at(T dt) const
+    {
+        static constexpr f weights[] = { 1.0 };
+        static constexpr f nodes[] = { s };
+        return combination<weights, nodes>(dt, T(1.0));
+    }
+
+    NERD_FORCEINLINE f3 end(T dt) const
+    {
+        return w0 + (dt / T(6.0)) * (k1 + T(2.0) * k23 + k4);
+    }
+};
+
+template<class Integrator, class T, size_t... E>
+NERD_FORCEINLINE basic_quat<T> commutatorFreeIncrement(const AngularVelocityStages<T>& stages, T dt, std::index_sequence<E...>)
+{
+    // Compose the stage rotations first so the orientation is updated only once
+    const T halfStep = T(0.5) * dt;
+    const basic_quat<T> exponentials[] = { halfExponential<Integrator>(stages.template combination<Integrator::beta[E], Integrator::c>(dt, halfStep))... };
+    basic_quat<T> increment = exponentials[0];
+    for (size_t e = 1; e < sizeof...(E); ++e)
+    {
+        increment = increment * exponentials[e];
+    }
+    return increment;
+}
+
+// dt * sum_s weights[s] * k[s], skipping the zero weights at compile time
+template<const auto& weights, class T, size_t... S>
+NERD_FORCEINLINE basic_f3<T> combine(const basic_f3<T> (&k)[sizeof...(S)], T dt, std::index_sequence<S...>)
+{
+    basic_f3<T> result;
+    bool empty = true;
+    (accumulate<weights[S]>(result, empty, dt, k[S]), ...);
+    return result;
+}
+
+template<class Integrator, class T, size_t... S>
+NERD_FORCEINLINE basic_quat<T> muntheKaasIncrement(const AngularVelocityStages<T>& stages, T dt, std::index_sequence<S...> stageIndices)
+{
+    const basic_f3<T> w[] = { stages.template at<Integrator::c[S]>(dt)... };
+    basic_f3<T> k[Integrator::stages];
+    // Stages depend on the previous ones: the comma fold keeps them in order
+    ((k[S] = inverseDifferential<Integrator>(combine<Integrator::a[S]>(k, dt, stageIndices), w[S])), ...);
+    return exponential<Integrator>(combine<Integrator::b>(k, dt, stageIndices));
+}
+
+} // namespace detail
+
+// Advances the orientation and the body frame angular velocity by dt, in the precision T.
+// Forced inline, with its helpers, so each Simulate instantiation gets a straight-line kernel.
+template<class Integrator, class T>
+NERD_FORCEINLINE void step(basic_quat<T>& orientation, const basic_f3<T>& eulerMotionVector, basic_f3<T>& frame_angular_velocity, T dt)
+{
+    const detail::AngularVelocityStages<T> stages(eulerMotionVector, frame_angular_velocity, dt);
+
+    if constexpr (Integrator::family == Family::CommutatorFree)
+    {
+        orientation = orientation * detail::commutatorFreeIncrement<Integrator>(stages, dt, std::make_index_sequence<Integrator::exponentials>{});
+    }
+    else
+    {
+        orientation = orientation * detail::muntheKaasIncrement<Integrator>(stages, dt, std::make_index_sequence<Integrator::stages>{});
+    }
+
+    frame_angular_velocity = stages.end(dt);
+}
+
+// Projection of the body angular velocity back onto the invariant manifold of the
+// free rigid body: the intersection of the energy ellipsoid w.I.w = 2E and of the
+// momentum sphere |I w|^2 = |L|^2, both taken from the initial velocity. One Newton
+// step along the two constraint gradients I w and I^2 w, the drift of a single step
+// being tiny.
+template<class T>
+struct InvariantManifold
+{
+    using f3 = basic_f3<T>;
+
+    f3 inertia;
+    T twiceEnergy;
+    T momentum2;
+
+    InvariantManifold(const f3& inertia, const f3& w) : inertia(inertia)
+    {
+        const f3 momentum = inertia * w;
+        twiceEnergy = dot(w, momentum);
+        momentum2 = dot(momentum, momentum);
+    }
+
+    NERD_FORCEINLINE void project(f3& w) const
+    {
+        const f3 u = inertia * w;
+        const f3 v = inertia * u;
+        const T uu = dot(u, u);
+        const T uv = dot(u, v);
+        const T vv = dot(v, v);
+        const T energyResidual = dot(w, u) - twiceEnergy;
+        const T momentumResidual = uu - momentum2;
+
+        // The gradients are parallel about a principal axis or for a sphere, where
+        // both constraints reduce to the norm of w
+        const T det = uu * vv - uv * uv;
+        if (det <= T(64.0) * std::numeric_limits<T>::epsilon() * uu * vv)
+        {
+            if (uu > T(0.0))
+            {
+                w = std::sqrt(momentum2 / uu) * w;
+            }
+            return;
+        }
+
+        // 2 [u.u u.v; u.v v.v] (a, b) = -(energy residual, momentum residual)
+        const T scale = T(-0.5) / det;
+        const T a = scale * (vv * energyResidual - uv * momentumResidual);
+        const T b = scale * (uu * momentumResidual - uv * energyResidual);
+        w = w + a * u + b * v;
+    }
+};
+
+// Policy adapter: the Base integrator followed by InvariantManifold::project every step
+template<class Base>
+struct Projected : Base
+{
+    static constexpr bool projected = true;
+};
+
+template<class Integrator>
+constexpr bool is_projected = requires { Integrator::projected; };
+
+// step followed, for a Projected integrator, by the projection of the angular velocity
+template<class Integrator, class T>
+NERD_FORCEINLINE void step(basic_quat<T>& orientation, const basic_f3<T>& eulerMotionVector, basic_f3<T>& frame_angular_velocity, T dt,
+                           const InvariantManifold<T>& manifold)
+{
+    step<Integrator>(orientation, eulerMotionVector, frame_angular_velocity, dt);
+    if constexpr (is_projected<Integrator>)
+    {
+        manifold.project(frame_angular_velocity);
+    }
+}
+
+} // namespace integrators
+} // namespace rigidbody
@@ -5,13 +5,22 @@
 #include <cstdio>
 #include <cstddef>
 #include <cmath>
+#include <cstring>
 
 #include "all.h"
 
 #include <Helpers.h>
 #include "physicshelper.h"
 
+#include <array>
+#include <algorithm>
 #include <chrono>
+#include <functional>
+#include <numbers>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 #ifndef CANDIDATE
 #define CANDIDATE REC991
@@ -20,11 +29,13 @@
 namespace
 {
 static constexpr float simulation_epsilon = 1e-5f;
+// Default local tolerance of --extrapolate, in radians per macro step
+static constexpr double extrapolation_tolerance = 1e-10;
 
 using f3 = rigidbody::f3;
 
 // The simulations are ordered in increasing difficulty level.
-rigidbody::SimulationContext contexts[] =
+constexpr rigidbody::SimulationContext contexts[] =
 {
     {1.f,   f3(1.f, 1.f, 1.f),  f3(1.f, 0.f, 0.f),     f3(0.f, 0.5f, 0.f),  60.f},
     {0.5f,  f3(4.f, 4.f, 2.f),  f3(10.f, 5.f, 10.f),   f3(2.f, 2.f, 1.f),   60.f},
@@ -37,6 +48,21 @@ rigidbody::SimulationContext contexts[] =
     {.1f,   f3(1.f, 5.f, 2.f),  f3(32.f, 40.f, 10.f),  f3(-.3f, 2.5f, .5f),140.f},
 };
 
+// The setup of every context (inertia, Euler motion vector, initial angular velocity),
+// computed at compile time for --batch
+template<size_t N>
+constexpr std::array<rigidbody::PreparedContext, N> prepare(const rigidbody::SimulationContext (&table)[N])
+{
+    std::array<rigidbody::PreparedContext, N> prepared;
+    for (size_t i = 0; i < N; ++i)
+    {
+        prepared[i] = rigidbody::PreparedContext(table[i]);
+    }
+    return prepared;
+}
+
+constexpr auto prepared_contexts = prepare(contexts);
+
 rigidbody::f3x3 reference_solutions[] =
 {
     {f3(-0.598460f, -0.801153f,  0.000000f), f3( 0.801153f, -0.598460f,  0.000000f), f3( 0.000000f,  0.000000f,  1.000000f)},
@@ -51,8 +77,7 @@ rigidbody::f3x3 reference_solutions[] =
 
 rigidbody::f frobenius_norm(rigidbody::f3x3 const& A)
 {
-    auto B = A * A.transpose();
-    return B.trace();
+    return A.squaredFrobeniusNorm();
 };
 
 template<typename T, size_t N>
@@ -61,44 +86,958 @@ constexpr size_t array_size(const T(&)[N])
     return N;
 }
 
-} // namespace anonymous
+bool report(size_t i, rigidbody::f3x3 const& result, bool verbose = true)
+{
+    const size_t reference = i % array_size(reference_solutions);
+    rigidbody::f diff = frobenius_norm(result - reference_solutions[reference]);
+    const bool ok = std::abs(diff) < simulation_epsilon;
+    if (!verbose)
+    {
+        return ok;
+    }
 
-extern "C" int _tmain(int /* argc */, TCHAR** /* argv */)
+    if (ok)
+    {
+        std::printf("OK:      Simulation %zd: Difference with reference %f\n", i, diff);
+    }
+    else
+    {
+        std::printf("TOO FAR: Simulation %zd: Difference with reference %f\n", i, diff);
+    }
+    return ok;
+}
+
+// Calls body.operator()<Integrator>() with the integrator policy of an --integrator
+// name, so every mode picks its instantiation the same way
+template<class Body>
+decltype(auto) withIntegrator(const TCHAR* integrator, Body&& body)
+{
+    if (_tcscmp(integrator, _T("cg3")) == 0)
+    {
+        return body.template operator()<rigidbody::integrators::CG3>();
+    }
+    if (_tcscmp(integrator, _T("cf4")) == 0)
+    {
+        return body.template operator()<rigidbody::integrators::CF4>();
+    }
+    if (_tcscmp(integrator, _T("rkmk4")) == 0)
+    {
+        return body.template operator()<rigidbody::integrators::RKMK4>();
+    }
+    throw std::runtime_error("Unknown integrator, expected cg3, cf4 or rkmk4");
+}
+
+using SimulateFunction = rigidbody::f3x3 (*)(rigidbody::SimulationContext const&);
+
+template<class Integrator, class Scalar>
+SimulateFunction simulateFor(bool project)
+{
+    return project ? &CANDIDATE::Simulate<rigidbody::integrators::Projected<Integrator>, Scalar>
+                   : &CANDIDATE::Simulate<Integrator, Scalar>;
+}
+
+template<class Integrator, class Scalar>
+SimulateFunction simulateFor(bool project, bool polynomialExp)
+{
+    return polynomialExp ? simulateFor<rigidbody::integrators::PolynomialExp<Integrator>, Scalar>(project)
+                         : simulateFor<Integrator, Scalar>(project);
+}
+
+// CANDIDATE::Simulate instantiation for an --integrator name, projected on the
+// invariants or not, with the rotations built by libm or by expmapPolynomial
+template<class Scalar>
+SimulateFunction selectSimulate(const TCHAR* integrator, bool project, bool polynomialExp)
+{
+    return withIntegrator(integrator, [&]<class Integrator>() { return simulateFor<Integrator, Scalar>(project, polynomialExp); });
+}
+
+// CANDIDATE::SimulateFastForward instantiation for an --integrator name
+SimulateFunction selectFastForward(const TCHAR* integrator)
+{
+    return withIntegrator(integrator, []<class Integrator>() { return &CANDIDATE::SimulateFastForward<Integrator>; });
+}
+
+// Kernel ISA level for an --isa name
+CANDIDATE::dispatch::Isa selectIsa(const TCHAR* isa)
+{
+    using CANDIDATE::dispatch::Isa;
+    if (_tcscmp(isa, _T("baseline")) == 0)
+    {
+        return Isa::Baseline;
+    }
+    if (_tcscmp(isa, _T("avx2")) == 0)
+    {
+        return Isa::AVX2;
+    }
+    if (_tcscmp(isa, _T("avx512")) == 0)
+    {
+        return Isa::AVX512;
+    }
+    throw std::runtime_error("Unknown ISA level, expected baseline, avx2 or avx512");
+}
+
+struct Options
+{
+    bool batch = false;     // --batch: simulate through CANDIDATE::SimulateBatch
+    unsigned threads = 0;   // --threads N: worker count, 0 = one per hardware thread
+    size_t sweep = 0;       // --sweep N: simulate N contexts cycling over the built-in ones
+    double tolerance = 0.0; // --adaptive TOL: simulate through CANDIDATE::SimulateAdaptive
+    bool analytic = false;  // --analytic: evaluate CANDIDATE::AnalyticSimulate
+    bool bench = false;     // --bench: run the kernel microbenchmarks
+    bool single = false;    // --float: integrate in float32 (Simulate and SimulateBatch)
+    bool validateFloat = false; // --validate-float: report the drift of the float32 path
+    double moserVeselov = 0.0;  // --moser-veselov DT: simulate through CANDIDATE::SimulateMoserVeselov
+    bool dtSweep = false;       // --dt-sweep: error against time step of Simulate and Moser-Veselov
+    double extrapolate = 0.0;   // --extrapolate H: simulate through CANDIDATE::SimulateExtrapolation, --adaptive TOL sets its tolerance
+    unsigned parareal = 0;      // --parareal N: CANDIDATE::SimulateParareal over N slices against the thread count
+    const TCHAR* coarse = _T("yoshida6"); // --coarse cg3|suzuki4|yoshida6: coarse propagator of --parareal
+    bool fastForward = false;   // --fast-forward: simulate through CANDIDATE::SimulateFastForward
+    bool project = false;       // --project: project Simulate back onto the energy and momentum invariants
+    bool fastExp = false;       // --fast-exp: build the rotations of cf4 and rkmk4 with polynomials instead of sin and cos (cg3 always does)
+    const TCHAR* integrator = _T("cg3"); // --integrator cg3|cf4|rkmk4: orientation integrator of Simulate
+    size_t samples = 0;                  // --samples N: CANDIDATE::SimulateAt at N times over every context
+    bool events = false;                 // --events: flips and cone crossings of every context with CANDIDATE::SimulateEvents
+    bool sensitivity = false;            // --sensitivity: CANDIDATE::SimulateSensitivity against finite differences
+    size_t shoot = 0;                    // --shoot N: CANDIDATE::SolveShooting on N targets reached from the built-in contexts
+    size_t monteCarlo = 0;               // --monte-carlo N: CANDIDATE::SimulateMonteCarlo of N samples around every context
+    const TCHAR* isa = nullptr;          // --isa baseline|avx2|avx512: kernel level below the one the CPU supports
+    bool printIsa = false;               // --print-isa: print the kernel ISA levels and the active one
+    SimulateFunction simulate = nullptr; // Simulate instantiation for integrator, project, fastExp and single
+};
+
+Options parseOptions(int argc, TCHAR** argv)
+{
+    Options options;
+    for (int arg = 1; arg < argc; ++arg)
+    {
+        if (_tcscmp(argv[arg], _T("--batch")) == 0)
+        {
+            options.batch = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--threads")) == 0 && arg + 1 < argc)
+        {
+            options.threads = static_cast<unsigned>(_ttoi(argv[++arg]));
+        }
+        else if (_tcscmp(argv[arg], _T("--sweep")) == 0 && arg + 1 < argc)
+        {
+            options.sweep = static_cast<size_t>(_ttoi(argv[++arg]));
+        }
+        else if (_tcscmp(argv[arg], _T("--bench")) == 0)
+        {
+            options.bench = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--analytic")) == 0)
+        {
+            options.analytic = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--adaptive")) == 0 && arg + 1 < argc)
+        {
+            options.tolerance = _ttof(argv[++arg]);
+        }
+        else if (_tcscmp(argv[arg], _T("--integrator")) == 0 && arg + 1 < argc)
+        {
+            options.integrator = argv[++arg];
+        }
+        else if (_tcscmp(argv[arg], _T("--float")) == 0)
+        {
+            options.single = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--validate-float")) == 0)
+        {
+            options.validateFloat = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--moser-veselov")) == 0 && arg + 1 < argc)
+        {
+            options.moserVeselov = _ttof(argv[++arg]);
+        }
+        else if (_tcscmp(argv[arg], _T("--dt-sweep")) == 0)
+        {
+            options.dtSweep = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--extrapolate")) == 0 && arg + 1 < argc)
+        {
+            options.extrapolate = _ttof(argv[++arg]);
+        }
+        else if (_tcscmp(argv[arg], _T("--parareal")) == 0 && arg + 1 < argc)
+        {
+            options.parareal = static_cast<unsigned>(_ttoi(argv[++arg]));
+        }
+        else if (_tcscmp(argv[arg], _T("--coarse")) == 0 && arg + 1 < argc)
+        {
+            options.coarse = argv[++arg];
+        }
+        else if (_tcscmp(argv[arg], _T("--fast-forward")) == 0)
+        {
+            options.fastForward = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--project")) == 0)
+        {
+            options.project = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--fast-exp")) == 0)
+        {
+            options.fastExp = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--samples")) == 0 && arg + 1 < argc)
+        {
+            options.samples = static_cast<size_t>(_ttoi(argv[++arg]));
+        }
+        else if (_tcscmp(argv[arg], _T("--events")) == 0)
+        {
+            options.events = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--sensitivity")) == 0)
+        {
+            options.sensitivity = true;
+        }
+        else if (_tcscmp(argv[arg], _T("--shoot")) == 0 && arg + 1 < argc)
+        {
+            options.shoot = static_cast<size_t>(_ttoi(argv[++arg]));
+        }
+        else if (_tcscmp(argv[arg], _T("--monte-carlo")) == 0 && arg + 1 < argc)
+        {
+            options.monteCarlo = static_cast<size_t>(_ttoi(argv[++arg]));
+        }
+        else if (_tcscmp(argv[arg], _T("--isa")) == 0 && arg + 1 < argc)
+        {
+            options.isa = argv[++arg];
+        }
+        else if (_tcscmp(argv[arg], _T("--print-isa")) == 0)
+        {
+            options.printIsa = true;
+        }
+    }
+    if (options.fastForward)
+    {
+        options.simulate = selectFastForward(options.integrator);
+    }
+    else
+    {
+        options.simulate = options.single ? selectSimulate<float>(options.integrator, options.project, options.fastExp)
+                                          : selectSimulate<double>(options.integrator, options.project, options.fastExp);
+    }
+    return options;
+}
+
+// Simulates every scenario on the scheduler, longest estimated first, and reports
+// them in order once they are all done.
+void runScenarios(std::span<const rigidbody::SimulationContext> scenarios, const Options& options, unsigned threads, bool verbose)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    std::vector<double> costs(scenarios.size());
+    for (size_t i = 0; i < scenarios.size(); ++i)
+    {
+        costs[i] = scenarios[i].final_time / CANDIDATE::time_step;
+    }
+
+    std::vector<f3x3> results(scenarios.size());
+    std::vector<clock::duration> durations(scenarios.size());
+
+    auto startTime = clock::now();
+    CANDIDATE::RunScheduled(costs, [&](size_t i)
+    {
+        auto simulationStartTime = clock::now();
+        results[i] = options.simulate(scenarios[i]);
+        durations[i] = clock::now() - simulationStartTime;
+    }, threads);
+    auto endTime = clock::now();
+
+    size_t okCount = 0;
+    for (size_t i = 0; i < scenarios.size(); ++i)
+    {
+        okCount += report(i, results[i], verbose) ? 1 : 0;
+        if (verbose)
+        {
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(durations[i]);
+            std::cout << "Simulation Duration (seconds): "
+                << duration << "\n";
+        }
+#ifdef HAVE_CHECK
+        // plug more tests here ?
+#endif
+    }
+
+    if (!verbose)
+    {
+        std::printf("Sweep: %zd simulations, %zd OK, %zd TOO FAR\n", scenarios.size(), okCount, scenarios.size() - okCount);
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    std::cout << "Total Time (seconds): "
+        << duration << "\n";
+}
+
+// Drift of the float32 path: scalar Simulate and SimulateBatch in float against the
+// reference solutions and against the same integrator in double.
+void validateFloat(const Options& options)
 {
     using namespace rigidbody;
 
+    const size_t arraySize = array_size(contexts);
+    const SimulateFunction simulateDouble = selectSimulate<double>(options.integrator, options.project, options.fastExp);
+    const SimulateFunction simulateFloat = selectSimulate<float>(options.integrator, options.project, options.fastExp);
+
+    f3x3 batchResults[array_size(contexts)];
+    CANDIDATE::SimulateBatch<float>(contexts, batchResults);
+
+    f maxDrift = 0.0;
+    size_t withinTolerance = 0;
+    for (size_t i = 0; i < arraySize; ++i)
+    {
+        const f3x3 doubleResult = simulateDouble(contexts[i]);
+        const f3x3 floatResult = simulateFloat(contexts[i]);
+
+        const f drift = frobenius_norm(floatResult - reference_solutions[i]);
+        const f batchDrift = frobenius_norm(batchResults[i] - reference_solutions[i]);
+        const f precisionDrift = frobenius_norm(floatResult - doubleResult);
+        maxDrift = std::max({ maxDrift, drift, batchDrift });
+        withinTolerance += (drift < simulation_epsilon && batchDrift < simulation_epsilon) ? 1 : 0;
+
+        std::printf("Simulation %zd: float drift vs reference %.3e (batch %.3e), vs double %.3e\n",
+                    i, drift, batchDrift, precisionDrift);
+    }
+    std::printf("Float drift: max %.3e, %zd of %zd simulations within %.0e\n",
+                maxDrift, withinTolerance, arraySize, simulation_epsilon);
+}
+
+struct SweepResult
+{
+    rigidbody::f maxError = 0.0;        // squared Frobenius distance to AnalyticSimulate
+    rigidbody::f maxEnergyError = -1.0; // relative, negative when the engine does not report it
+    size_t okCount = 0;                 // within simulation_epsilon of reference_solutions
+    double milliseconds = 0.0;
+    bool diverged = false;
+};
+
+// One time stepping engine of the dt sweep: writes the relative energy error of the
+// run to energyError when it tracks it
+struct SweepEngine
+{
+    const char* name;
+    std::function<rigidbody::f3x3(rigidbody::SimulationContext const&, rigidbody::f dt, rigidbody::f& energyError)> simulate;
+};
+
+SweepResult sweepContexts(const rigidbody::f3x3 (&exact)[array_size(contexts)], const SweepEngine& engine, rigidbody::f dt)
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    SweepResult result;
+    auto startTime = clock::now();
     try
     {
-        CANDIDATE::GlobalInit();
-        auto startTime = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < array_size(contexts); ++i)
+        {
+            rigidbody::f energyError = -1.0;
+            const rigidbody::f3x3 orientation = engine.simulate(contexts[i], dt, energyError);
+            result.maxError = std::max(result.maxError, frobenius_norm(orientation - exact[i]));
+            result.maxEnergyError = std::max(result.maxEnergyError, energyError);
+            result.okCount += report(i, orientation, false) ? 1 : 0;
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        result.diverged = true;
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+    return result;
+}
+
+template<class Composition>
+SweepEngine splittingEngine()
+{
+    return { Composition::name, [](const rigidbody::SimulationContext& context, rigidbody::f dt, rigidbody::f& energyError)
+    {
+        const CANDIDATE::SplittingResult result = CANDIDATE::SimulateSplitting<Composition>(context, dt);
+        energyError = result.max_energy_error;
+        return result.orientation;
+    } };
+}
+
+// Error against the time step of Simulate (the selected integrator, without and with
+// the invariant projection), the Moser-Veselov engine and the splitting compositions
+// over the built-in contexts, with AnalyticSimulate as the exact solution
+void compareTimeSteps(const Options& options)
+{
+    using namespace rigidbody;
+
+    static constexpr f time_steps[] = { 0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1 };
+
+    f3x3 exact[array_size(contexts)];
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        exact[i] = CANDIDATE::AnalyticSimulate(contexts[i]);
+    }
+
+    // Simulate reads the global time step
+    const auto withTimeStep = [](SimulateFunction simulate)
+    {
+        return [simulate](const SimulationContext& context, f dt, f&)
+        {
+            const f savedTimeStep = CANDIDATE::time_step;
+            CANDIDATE::time_step = dt;
+            const f3x3 result = simulate(context);
+            CANDIDATE::time_step = savedTimeStep;
+            return result;
+        };
+    };
+    const SimulateFunction simulate = options.single ? selectSimulate<float>(options.integrator, false, options.fastExp)
+                                                     : selectSimulate<double>(options.integrator, false, options.fastExp);
+    const SimulateFunction projected = options.single ? selectSimulate<float>(options.integrator, true, options.fastExp)
+                                                      : selectSimulate<double>(options.integrator, true, options.fastExp);
+
+    const SweepEngine engines[] =
+    {
+        { "Simulate", withTimeStep(simulate) },
+        { "Simulate projected", withTimeStep(projected) },
+        { "Moser-Veselov", [](const SimulationContext& context, f dt, f&) { return CANDIDATE::SimulateMoserVeselov(context, dt); } },
+        splittingEngine<splitting::Strang2>(),
+        splittingEngine<splitting::Yoshida4>(),
+        splittingEngine<splitting::Suzuki4>(),
+        splittingEngine<splitting::Yoshida6>(),
+    };
+
+    for (const SweepEngine& engine : engines)
+    {
+        std::printf("%s\n", engine.name);
+        std::printf("%8s %10s %4s %12s %9s\n", "dt", "max error", "OK", "energy error", "time");
+        for (const f dt : time_steps)
+        {
+            const SweepResult result = sweepContexts(exact, engine, dt);
+            if (result.diverged)
+            {
+                std::printf("%8g %10s\n", dt, "diverged");
+                continue;
+            }
+            std::printf("%8g %10.3e %zd/%zd ", dt, result.maxError, result.okCount, array_size(contexts));
+            if (result.maxEnergyError < 0.0)
+            {
+                std::printf("%12s", "-");
+            }
+            else
+            {
+                std::printf("%12.3e", result.maxEnergyError);
+            }
+            std::printf(" %7.1fms\n", result.milliseconds);
+        }
+    }
+}
+
+// CANDIDATE::SimulateExtrapolation of the selected integrator over the built-in
+// contexts. They run one after the other, so the columns of every macro step get the
+// threads.
+void simulateExtrapolation(const Options& options)
+{
+    using namespace rigidbody;
+
+    const auto simulate = withIntegrator(options.integrator, []<class Integrator>() { return &CANDIDATE::SimulateExtrapolation<Integrator>; });
+
+    const unsigned columnThreads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    const f tolerance = options.tolerance > 0.0 ? options.tolerance : extrapolation_tolerance;
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        auto simulationStartTime = std::chrono::high_resolution_clock::now();
+        const CANDIDATE::AdaptiveResult result = simulate(contexts[i], options.extrapolate, tolerance, columnThreads);
+        auto simulationEndTime = std::chrono::high_resolution_clock::now();
+        report(i, result.orientation);
+        std::printf("         Macro steps: %d accepted, %d rejected\n", result.accepted_steps, result.rejected_steps);
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(simulationEndTime - simulationStartTime);
+        std::cout << "Simulation Duration (seconds): "
+            << duration << "\n";
+    }
+}
+
+// CANDIDATE::SimulateAt of the selected integrator at samples times spread evenly over
+// every built-in context: the last one, at final_time, is checked against the
+// reference, and all of them against AnalyticSimulate.
+void simulateAt(const Options& options)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    const auto simulate = withIntegrator(options.integrator, []<class Integrator>() { return &CANDIDATE::SimulateAt<Integrator>; });
+
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        std::vector<f> times(options.samples);
+        for (size_t k = 0; k < times.size(); ++k)
+        {
+            times[k] = contexts[i].final_time * f(k + 1) / f(times.size());
+        }
+
+        auto startTime = clock::now();
+        const std::vector<CANDIDATE::TrajectorySample> samples = simulate(contexts[i], times);
+        const double time = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+
+        f maxError = 0.0;
+        for (size_t k = 0; k < times.size(); ++k)
+        {
+            SimulationContext sampleContext = contexts[i];
+            sampleContext.final_time = times[k];
+            maxError = std::max(maxError, frobenius_norm(samples[k].orientation - CANDIDATE::AnalyticSimulate(sampleContext)));
+        }
+
+        report(i, samples.back().orientation);
+        std::printf("         %zd samples in %.1fms, max error vs analytic %.3e\n", times.size(), time, maxError);
+    }
+}
 
+// CANDIDATE::SimulateEvents of the selected integrator on every built-in context with
+// two detectors: the flips, where the angular velocity on the intermediate axis
+// changes sign (the intermediate axis crosses the plane normal to the angular
+// momentum), and the crossings of the body z axis through the 60 degree cone around
+// its initial direction, whose times are checked against AnalyticSimulate.
+void simulateEvents(const Options& options)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    const auto simulate = withIntegrator(options.integrator, []<class Integrator>() { return &CANDIDATE::SimulateEvents<Integrator>; });
+
+    const f coneCosine = std::cos(std::numbers::pi / 3.0);
+    const auto cone = [coneCosine](const f3x3& orientation) { return (orientation * f3(0.0, 0.0, 1.0))[2] - coneCosine; };
+
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        const f3 inertia = contexts[i].ComputeInertiaTensor().d;
+        int intermediate = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const int below = (inertia[axis] > inertia[(axis + 1) % 3]) + (inertia[axis] > inertia[(axis + 2) % 3]);
+            if (below == 1)
+            {
+                intermediate = axis;
+            }
+        }
+
+        const CANDIDATE::EventDetector detectors[] =
+        {
+            { [intermediate](const CANDIDATE::TrajectorySample& state) { return state.angular_velocity[intermediate]; } },
+            { [&cone](const CANDIDATE::TrajectorySample& state) { return cone(state.orientation); } },
+        };
+
+        auto startTime = clock::now();
+        const std::vector<CANDIDATE::Event> events = simulate(contexts[i], std::span<const CANDIDATE::EventDetector>(detectors), 1e-12);
+        const double time = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+
+        size_t flips = 0;
+        size_t crossings = 0;
+        f maxResidual = 0.0;
+        for (const CANDIDATE::Event& event : events)
+        {
+            if (event.detector == 0)
+            {
+                ++flips;
+                continue;
+            }
+            ++crossings;
+            SimulationContext eventContext = contexts[i];
+            eventContext.final_time = event.time;
+            maxResidual = std::max(maxResidual, std::abs(cone(CANDIDATE::AnalyticSimulate(eventContext))));
+        }
+
+        std::printf("Context %zd: %zd flips", i, flips);
+        for (size_t k = 0, shown = 0; k < events.size() && shown < 4; ++k)
+        {
+            if (events[k].detector == 0)
+            {
+                std::printf("%s%.6f", shown++ == 0 ? " at " : ", ", events[k].time);
+            }
+        }
+        std::printf("%s, %zd cone crossings in %.1fms, max cone residual vs analytic %.3e\n",
+                    flips > 4 ? "..." : "", crossings, time, maxResidual);
+    }
+}
+
+// Context with the parameter of index parameter of CANDIDATE::Sensitivity offset by delta
+rigidbody::SimulationContext perturbed(const rigidbody::SimulationContext& context, int parameter, rigidbody::f delta)
+{
+    rigidbody::f3 impulse = context.initial_impulse;
+    rigidbody::f3 point = context.initial_impulse_application_point;
+    rigidbody::f density = context.density;
+    rigidbody::f3 lengths = context.lengths;
+    if (parameter < 3)
+    {
+        impulse[parameter] += delta;
+    }
+    else if (parameter < 6)
+    {
+        point[parameter - 3] += delta;
+    }
+    else if (parameter == 6)
+    {
+        density += delta;
+    }
+    else
+    {
+        lengths[parameter - 7] += delta;
+    }
+    return { density, lengths, impulse, point, context.final_time };
+}
+
+// CANDIDATE::SimulateSensitivity of the selected integrator on every built-in context
+// against central differences of Simulate, two runs per parameter: the time of both
+// and the largest difference of the Jacobians, relative to the largest derivative.
+void compareSensitivity(const Options& options)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    const auto sensitivity = withIntegrator(options.integrator, []<class Integrator>() { return &CANDIDATE::SimulateSensitivity<Integrator>; });
+    const SimulateFunction simulate = selectSimulate<double>(options.integrator, false, false);
+
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        auto startTime = clock::now();
+        const CANDIDATE::Sensitivity result = sensitivity(contexts[i]);
+        const double dualTime = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+
+        // Step of the order of the cube root of epsilon, the optimum of central differences
+        startTime = clock::now();
+        f3x3 differences[CANDIDATE::Sensitivity::parameter_count];
+        for (int parameter = 0; parameter < CANDIDATE::Sensitivity::parameter_count; ++parameter)
+        {
+            const f value = parameter < 3 ? contexts[i].initial_impulse[parameter]
+                          : parameter < 6 ? contexts[i].initial_impulse_application_point[parameter - 3]
+                          : parameter == 6 ? contexts[i].density
+                          : contexts[i].lengths[parameter - 7];
+            const f h = 1e-6 * std::max(std::abs(value), f(1.0));
+            differences[parameter] = (simulate(perturbed(contexts[i], parameter, h)) - simulate(perturbed(contexts[i], parameter, -h))) * (0.5 / h);
+        }
+        const double differenceTime = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+
+        f maxDifference = 0.0;
+        f maxDerivative = 0.0;
+        for (int parameter = 0; parameter < CANDIDATE::Sensitivity::parameter_count; ++parameter)
+        {
+            maxDifference = std::max(maxDifference, std::sqrt(frobenius_norm(result.jacobian[parameter] - differences[parameter])));
+            maxDerivative = std::max(maxDerivative, std::sqrt(frobenius_norm(result.jacobian[parameter])));
+        }
+
+        report(i, result.orientation);
+        std::printf("         Jacobian: dual numbers %.1fms, central differences (%d runs) %.1fms, difference %.3e of max derivative %.3e\n",
+                    dualTime, 2 * CANDIDATE::Sensitivity::parameter_count, differenceTime, maxDifference / maxDerivative, maxDerivative);
+    }
+}
+
+// CANDIDATE::SolveShooting on shoot targets: target k is the orientation the built-in
+// context k % 8 reaches, to be found from its impulse off by 1 to 5 per mille. Reports
+// every target up to 16, then the totals. The impulse along the application point adds
+// no torque, so only the torque is compared with the context.
+void solveShooting(const Options& options)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    std::vector<SimulationContext> reached(options.shoot);
+    for (size_t k = 0; k < reached.size(); ++k)
+    {
+        reached[k] = contexts[k % array_size(contexts)];
+    }
+    std::vector<f3x3> orientations(reached.size());
+    CANDIDATE::SimulateBatch<f>(reached, orientations);
+
+    std::vector<CANDIDATE::ShootingTarget> targets(reached.size());
+    for (size_t k = 0; k < targets.size(); ++k)
+    {
+        const SimulationContext& context = reached[k];
+        const f offset = 0.001 * f(1 + k % 5) * context.initial_impulse.norm();
+        f3 guess = context.initial_impulse;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            guess[axis] += offset * std::sin(1.7 * f(k) + 2.3 * f(axis));
+        }
+        targets[k] = { SimulationContext(context.density, context.lengths, guess, context.initial_impulse_application_point, context.final_time),
+                       orientations[k] };
+    }
+
+    auto startTime = clock::now();
+    const std::vector<CANDIDATE::ShootingResult> results = CANDIDATE::SolveShooting(targets, 1e-10, 50, options.threads);
+    const double time = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+
+    size_t converged = 0;
+    int iterations = 0;
+    int evaluations = 0;
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        const CANDIDATE::ShootingResult& result = results[k];
+        converged += result.converged;
+        iterations += result.iterations;
+        evaluations += result.evaluations;
+        if (k < 16)
+        {
+            std::printf("%s Target %zd (context %zd): %d iterations, %d evaluations, residual %.3e, torque error %.3e\n",
+                        result.converged ? "OK:     " : "FAILED: ", k, k % array_size(contexts), result.iterations, result.evaluations,
+                        result.residual, cross(reached[k].initial_impulse_application_point, result.impulse - reached[k].initial_impulse).norm());
+        }
+    }
+    std::printf("%zd of %zd targets converged, %d iterations and %d evaluations in total, in %.1fms\n",
+                converged, results.size(), iterations, evaluations, time);
+}
+
+// CANDIDATE::SimulateMonteCarlo of monteCarlo samples around every built-in context,
+// with normal jitters of 0.1% of the density, the lengths and the impulse norm, and of
+// 0.1% of the body size on the application point
+void simulateMonteCarlo(const Options& options)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        const SimulationContext& base = contexts[i];
+        CANDIDATE::Uncertainty uncertainty;
+        uncertainty.density = CANDIDATE::Jitter::normal(0.001 * base.density);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            uncertainty.lengths[axis] = CANDIDATE::Jitter::normal(0.001 * base.lengths[axis]);
+            uncertainty.initial_impulse[axis] = CANDIDATE::Jitter::normal(0.001 * base.initial_impulse.norm());
+            uncertainty.initial_impulse_application_point[axis] = CANDIDATE::Jitter::normal(0.001 * base.lengths.norm());
+        }
+
+        auto startTime = clock::now();
+        const CANDIDATE::MonteCarloStatistics statistics = CANDIDATE::SimulateMonteCarlo(base, uncertainty, options.monteCarlo, 2023, options.threads);
+        const double time = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+
+        const f meanToNominal = logmap(RotationMatrix3::fromOrthonormal(statistics.nominal_orientation).toQuat().conjugate() *
+                                       RotationMatrix3::fromOrthonormal(statistics.mean_orientation).toQuat()).norm();
+        std::printf("Context %zd: %zd samples in %.1fms, spread p50 %.3e p90 %.3e p99 %.3e max %.3e rad, mean %.3e rad from nominal, %.1f%% flipped\n",
+                    i, statistics.samples, time, statistics.spread_p50, statistics.spread_p90, statistics.spread_p99, statistics.spread_max,
+                    meanToNominal, 100.0 * statistics.flip_fraction);
+    }
+}
+
+using PararealFunction = CANDIDATE::PararealResult (*)(rigidbody::SimulationContext const&, unsigned, rigidbody::f, unsigned);
+
+// CANDIDATE::SimulateParareal instantiation of Integrator for a --coarse name
+template<class Integrator>
+PararealFunction selectParareal(const TCHAR* coarse)
+{
+    using namespace rigidbody;
+    if (_tcscmp(coarse, _T("cg3")) == 0)
+    {
+        return &CANDIDATE::SimulateParareal<Integrator, integrators::CG3>;
+    }
+    if (_tcscmp(coarse, _T("suzuki4")) == 0)
+    {
+        return &CANDIDATE::SimulateParareal<Integrator, splitting::Suzuki4>;
+    }
+    if (_tcscmp(coarse, _T("yoshida6")) == 0)
+    {
+        return &CANDIDATE::SimulateParareal<Integrator, splitting::Yoshida6>;
+    }
+    throw std::runtime_error("Unknown coarse propagator, expected cg3, suzuki4 or yoshida6");
+}
+
+// CANDIDATE::SimulateParareal of the selected integrator on every built-in context,
+// with 1, 2, 4, ... threads up to the hardware threads, against the serial Simulate.
+// The speedup is bounded by slices / iterations, and by the serial coarse sweeps.
+void compareParareal(const Options& options)
+{
+    using namespace rigidbody;
+    using clock = std::chrono::high_resolution_clock;
+
+    const auto simulate = withIntegrator(options.integrator, [&]<class Integrator>() { return selectParareal<Integrator>(options.coarse); });
+    const SimulateFunction serial = selectSimulate<double>(options.integrator, false, options.fastExp);
+
+    const unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+    {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(hardwareThreads);
+
+    for (size_t i = 0; i < array_size(contexts); ++i)
+    {
+        auto startTime = clock::now();
+        serial(contexts[i]);
+        const double serialTime = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+        std::printf("Simulation %zd: serial %.1fms, %u slices\n", i, serialTime, options.parareal);
+
+        CANDIDATE::PararealResult result;
+        for (const unsigned threads : threadCounts)
+        {
+            startTime = clock::now();
+            result = simulate(contexts[i], options.parareal, simulation_epsilon, threads);
+            const double time = std::chrono::duration<double, std::milli>(clock::now() - startTime).count();
+            std::printf("  %3u threads: %2d iterations, %8.1fms, speedup %.2f\n", threads, result.iterations, time, serialTime / time);
+        }
+        report(i, result.orientation);
+    }
+}
+
+} // namespace anonymous
+
+extern "C" int _tmain(int argc, TCHAR** argv)
+{
+    using namespace rigidbody;
+
+    try
+    {
+        const Options options = parseOptions(argc, argv);
         const size_t arraySize = array_size(contexts);
 
-        for (size_t i = 0; i < arraySize; ++i)
+        if (options.isa)
+        {
+            CANDIDATE::dispatch::SetActiveIsa(selectIsa(options.isa));
+        }
+        if (options.printIsa)
+        {
+            CANDIDATE::dispatch::PrintIsa();
+            return EXIT_SUCCESS;
+        }
+
+        if (options.batch)
         {
-            auto simulationStartTime = std::chrono::high_resolution_clock::now();;
-            f3x3 const result = CANDIDATE::Simulate(contexts[i]);
-            f diff = frobenius_norm(result - reference_solutions[i]);
-            if (std::abs(diff) < simulation_epsilon)
+            f3x3 results[array_size(contexts)];
+            auto startTime = std::chrono::high_resolution_clock::now();
+            if (options.single)
             {
-                std::printf("OK:      Simulation %zd: Difference with reference %f\n", i, diff);
+                CANDIDATE::SimulateBatch<float>(prepared_contexts, results);
             }
             else
             {
-                std::printf("TOO FAR: Simulation %zd: Difference with reference %f\n", i, diff);
+                CANDIDATE::SimulateBatch<double>(prepared_contexts, results);
             }
-            auto simulationEndTime = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(simulationEndTime - simulationStartTime);
-            std::cout << "Simulation Duration (seconds): "
+            auto endTime = std::chrono::high_resolution_clock::now();
+
+            for (size_t i = 0; i < arraySize; ++i)
+            {
+                report(i, results[i]);
+            }
+            auto duration = duration_cast<std::chrono::milliseconds>(endTime - startTime);
+            std::cout << "Batch Time (seconds): "
                 << duration << "\n";
-#ifdef HAVE_CHECK
-            // plug more tests here ?
-#endif
+            return EXIT_SUCCESS;
+        }
+
+        if (options.dtSweep)
+        {
+            compareTimeSteps(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.moserVeselov > 0.0)
+        {
+            for (size_t i = 0; i < arraySize; ++i)
+            {
+                auto simulationStartTime = std::chrono::high_resolution_clock::now();
+                f3x3 const result = CANDIDATE::SimulateMoserVeselov(contexts[i], options.moserVeselov);
+                auto simulationEndTime = std::chrono::high_resolution_clock::now();
+                report(i, result);
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(simulationEndTime - simulationStartTime);
+                std::cout << "Simulation Duration (seconds): "
+                    << duration << "\n";
+            }
+            return EXIT_SUCCESS;
+        }
+
+        if (options.validateFloat)
+        {
+            validateFloat(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.bench)
+        {
+            CANDIDATE::RunBenchmarks();
+            return EXIT_SUCCESS;
+        }
+
+        if (options.analytic)
+        {
+            for (size_t i = 0; i < arraySize; ++i)
+            {
+                auto simulationStartTime = std::chrono::high_resolution_clock::now();
+                f3x3 const result = CANDIDATE::AnalyticSimulate(contexts[i]);
+                auto simulationEndTime = std::chrono::high_resolution_clock::now();
+                report(i, result);
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(simulationEndTime - simulationStartTime);
+                std::cout << "Simulation Duration (seconds): "
+                    << duration << "\n";
+            }
+            return EXIT_SUCCESS;
+        }
+
+        if (options.parareal > 0)
+        {
+            compareParareal(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.samples > 0)
+        {
+            simulateAt(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.events)
+        {
+            simulateEvents(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.sensitivity)
+        {
+            compareSensitivity(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.shoot > 0)
+        {
+            solveShooting(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.monteCarlo > 0)
+        {
+            simulateMonteCarlo(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.extrapolate > 0.0)
+        {
+            simulateExtrapolation(options);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.tolerance > 0.0)
+        {
+            for (size_t i = 0; i < arraySize; ++i)
+            {
+                auto simulationStartTime = std::chrono::high_resolution_clock::now();
+                const CANDIDATE::AdaptiveResult result = CANDIDATE::SimulateAdaptive(contexts[i], options.tolerance);
+                auto simulationEndTime = std::chrono::high_resolution_clock::now();
+                report(i, result.orientation);
+                const int fixedSteps = static_cast<int>(std::ceil(contexts[i].final_time / CANDIDATE::time_step));
+                std::printf("         Steps: %d accepted, %d rejected (fixed step: %d)\n", result.accepted_steps, result.rejected_steps, fixedSteps);
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(simulationEndTime - simulationStartTime);
+                std::cout << "Simulation Duration (seconds): "
+                    << duration << "\n";
+            }
+            return EXIT_SUCCESS;
+        }
+
+        CANDIDATE::GlobalInit();
+
+        const unsigned threads = std::min(options.threads ? options.threads : std::thread::hardware_concurrency(),
+                                          CANDIDATE::SimulationConcurrency());
+
+        if (options.sweep)
+        {
+            std::vector<SimulationContext> scenarios(options.sweep);
+            for (size_t i = 0; i < scenarios.size(); ++i)
+            {
+                scenarios[i] = contexts[i % arraySize];
+            }
+            runScenarios(scenarios, options, threads, false);
+        }
+        else
+        {
+            runScenarios(contexts, options, threads, true);
         }
-        auto endTime = std::chrono::high_resolution_clock::now();
-        auto duration = duration_cast<std::chrono::milliseconds>(endTime - startTime);
-        std::cout << "Total Time (seconds): "
-            << duration << "\n";
 
         CANDIDATE::GlobalTeardown();
     }
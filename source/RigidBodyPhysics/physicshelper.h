@@ -3,7 +3,13 @@
 #include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <cassert>
 #include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include <Helpers.h>
 
 namespace rigidbody
 {
@@ -16,108 +22,179 @@ namespace rigidbody
 using f = double;
 static int VECTOR_COPIES = 0;
 
-struct f3
+// Checks of the math types, chosen at compile time with -DRIGIDBODY_MATH_CHECKS=...:
+//  - Checked: a division by zero throws std::runtime_error
+//  - DebugAssert: it asserts, so release builds (NDEBUG) have no check at all
+//  - Unchecked: no check, IEEE semantics
+// The default keeps the integration loops free of throws, invalid input is rejected
+// once by the BasicSimulationContext constructor instead.
+enum class MathChecks
+{
+    Checked,
+    DebugAssert,
+    Unchecked,
+};
+
+#ifndef RIGIDBODY_MATH_CHECKS
+#define RIGIDBODY_MATH_CHECKS DebugAssert
+#endif
+
+static constexpr MathChecks math_checks = MathChecks::RIGIDBODY_MATH_CHECKS;
+
+template<class T>
+constexpr void checkDivisor(T divisor)
+{
+    if constexpr (math_checks == MathChecks::Checked)
+    {
+        if (divisor == T(0.0))
+        {
+            throw std::runtime_error("Division by zero");
+        }
+    }
+    else if constexpr (math_checks == MathChecks::DebugAssert)
+    {
+        assert(divisor != T(0.0) && "Division by zero");
+    }
+}
+
+// The math types are templated on the scalar so the simulation can run in float32
+// when throughput matters more than accuracy, or over Dual (dual.h) for derivatives:
+// the math functions are called unqualified, after a using std::sqrt, so that
+// argument dependent lookup finds the overloads of other scalars. f3, f3x3, quat and
+// SimulationContext are the double precision instantiations used everywhere else.
+template<class T>
+struct basic_f3
 {
+    using scalar = T;
+
+    // The named components are the active member: constant evaluation, which cannot
+    // read the other one, indexes them through operator[]
     union {
         struct {
-            f x;
-            f y;
-            f z;
+            T x;
+            T y;
+            T z;
         };
-        f v[3];
+        T v[3];
     };
 
 
-    f3() : v{ 0.0, 0.0, 0.0 } {}
-    f3(f x, f y, f z) : v{ x, y, z } {}
-    f3(f const v[3]) : v{ v[0], v[1], v[2] } {}
+    constexpr basic_f3() : x(0.0), y(0.0), z(0.0) {}
+    constexpr basic_f3(T x, T y, T z) : x(x), y(y), z(z) {}
+    constexpr basic_f3(T const v[3]) : x(v[0]), y(v[1]), z(v[2]) {}
 
-    f3 operator+(f3 const& rhs) const
+    template<class U>
+    constexpr basic_f3<U> cast() const
     {
-        return f3(x + rhs.x, y + rhs.y, z + rhs.z);
+        return basic_f3<U>(static_cast<U>(x), static_cast<U>(y), static_cast<U>(z));
     }
-    f3 operator-(f3 const& rhs) const
+
+    constexpr basic_f3 operator+(basic_f3 const& rhs) const
     {
-        return f3(x - rhs.x, y - rhs.y, z - rhs.z);
+        return basic_f3(x + rhs.x, y + rhs.y, z + rhs.z);
     }
-    f3 operator*(f3 const& rhs) const
+    constexpr basic_f3 operator-(basic_f3 const& rhs) const
     {
-        return f3(x * rhs.x, y * rhs.y, z * rhs.z);
+        return basic_f3(x - rhs.x, y - rhs.y, z - rhs.z);
     }
-    bool operator==(const f3& rhs) const
+    constexpr basic_f3 operator*(basic_f3 const& rhs) const
     {
-        return v[0] == rhs[0] && v[1] == rhs[1] && v[2] == rhs[2];
+        return basic_f3(x * rhs.x, y * rhs.y, z * rhs.z);
+    }
+    constexpr bool operator==(const basic_f3& rhs) const
+    {
+        return x == rhs.x && y == rhs.y && z == rhs.z;
     }
 
-    f3 operator*(f scal) const
+    constexpr basic_f3 operator*(T scal) const
     {
-        return f3(scal * x, scal * y, scal * z);
+        return basic_f3(scal * x, scal * y, scal * z);
     }
-    f3 operator/(f scal) const
+    constexpr basic_f3 operator/(T scal) const
     {
-        if (scal == 0.0)
-        {
-            throw std::runtime_error("Division by zero");
-        }
-        return f3(x / scal, y / scal, z / scal);
+        checkDivisor(scal);
+        return basic_f3(x / scal, y / scal, z / scal);
     }
-    f3 operator-() const
+    constexpr basic_f3 operator-() const
     {
-        return f3(-x, -y, -z);
+        return basic_f3(-x, -y, -z);
     }
-    const f& operator[](int a) const
+    constexpr const T& operator[](int a) const
     {
-        return v[a];
+        if consteval
+        {
+            return a == 0 ? x : a == 1 ? y : z;
+        }
+        else
+        {
+            return v[a];
+        }
     }
-    f& operator[](int a)
+    constexpr T& operator[](int a)
     {
-        return v[a];
+        if consteval
+        {
+            return a == 0 ? x : a == 1 ? y : z;
+        }
+        else
+        {
+            return v[a];
+        }
     }
 
-    friend f3 operator*(const f scal, const f3& v)
+    friend constexpr basic_f3 operator*(const T scal, const basic_f3& v)
     {
-        return f3(scal * v.x, scal * v.y, scal * v.z);
+        return basic_f3(scal * v.x, scal * v.y, scal * v.z);
     }
 
-	f norm() const
+	constexpr T norm() const
 	{
-		return std::sqrt(x * x + y * y + z * z);
+		using std::sqrt;
+		return sqrt(x * x + y * y + z * z);
 	}
 
-    f3 normalized() const
+    constexpr basic_f3 normalized() const
     {
-        f norm = this->norm();
-        return norm == 0 ? v : *this / norm;
+        T norm = this->norm();
+        return norm == 0 ? *this : *this / norm;
     }
 
-    void normalize()
+    constexpr void normalize()
     {
         *this = *this/this->norm();
     }
 };
 
+using f3 = basic_f3<f>;
+
 // Stream insertion for printing
-inline std::ostream& operator<<(std::ostream& os, const f3& v) {
+template<class T>
+inline std::ostream& operator<<(std::ostream& os, const basic_f3<T>& v) {
     os << "(" << v.x << ", " << v.y << ", " << v.z << ")";
     return os;
 }
 
-inline f dot(const f3& a, const f3& b)
+template<class T>
+constexpr T dot(const basic_f3<T>& a, const basic_f3<T>& b)
 {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-inline f3 cross(const f3& a, const f3& b)
+template<class T>
+constexpr basic_f3<T> cross(const basic_f3<T>& a, const basic_f3<T>& b)
 {
-    return f3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    return basic_f3<T>(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
 }
 
-struct f3x3
+template<class T>
+struct basic_f3x3
 {
+    using f3 = basic_f3<T>;
+
     f3 m[3];
 
-    f3x3() { f3(), f3(), f3(); }
-    f3x3(const f3& row0, const f3& row1, const f3& row2)
+    constexpr basic_f3x3() = default;
+    constexpr basic_f3x3(const f3& row0, const f3& row1, const f3& row2)
     {
         m[0][0] = row0[0];
         m[0][1] = row0[1];
@@ -132,168 +209,299 @@ struct f3x3
         m[2][2] = row2[2];
     }
 
-    f3x3 transpose() const
+    template<class U>
+    constexpr basic_f3x3<U> cast() const
+    {
+        return basic_f3x3<U>(m[0].template cast<U>(), m[1].template cast<U>(), m[2].template cast<U>());
+    }
+
+    constexpr basic_f3x3 transpose() const
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
             for (int j = 0; j < 3; ++j)
                 result.m[i][j] = m[j][i];
         return result;
     }
 
-    f3x3 operator*(f const& scal) const
+    constexpr basic_f3x3 operator*(T const& scal) const
     {
-        return f3x3(m[0] * scal, m[1] * scal, m[2] * scal);
+        return basic_f3x3(m[0] * scal, m[1] * scal, m[2] * scal);
     }
 
-    f3x3 operator*(f3x3 const& rhs) const
+    constexpr basic_f3x3 operator*(basic_f3x3 const& rhs) const
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
             for (int j = 0; j < 3; ++j)
                 result[i][j] = dot(m[i], f3(rhs[0][j], rhs[1][j], rhs[2][j]));
         return result;
     }
 
-    f3 operator*(f3 const& rhs) const
+    constexpr f3 operator*(f3 const& rhs) const
     {
         return f3(dot(m[0], rhs), dot(m[1], rhs), dot(m[2], rhs));
     }
 
-    bool operator==(const f3x3& rhs) const
+    constexpr bool operator==(const basic_f3x3& rhs) const
     {
         return m[0] == rhs[0] && m[1] == rhs[1] && m[2] == rhs[2];
     }
 
-    static f3x3 id()
+    static constexpr basic_f3x3 id()
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
             result.m[i][i] = 1.0;
         return result;
     }
 
-    static f3x3 diagonal(const f3& d)
+    static constexpr basic_f3x3 diagonal(const f3& d)
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
-            result.m[i][i] = d.v[i];
+            result.m[i][i] = d[i];
         return result;
     }
 
-    static f3x3 zero()
+    static constexpr basic_f3x3 zero()
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
             for (int j = 0; j < 3; ++j)
                 result.m[i][j] = 0.0;
         return result;
     }
 
-    f3x3 operator+(const f3x3& rhs) const
+    constexpr basic_f3x3 operator+(const basic_f3x3& rhs) const
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
             for (int j = 0; j < 3; ++j)
                 result.m[i][j] = m[i][j] + rhs.m[i][j];
         return result;
     }
 
-    f3x3 operator-(const f3x3& rhs) const
+    constexpr basic_f3x3 operator-(const basic_f3x3& rhs) const
     {
-        f3x3 result;
+        basic_f3x3 result;
         for (int i = 0; i < 3; ++i)
             for (int j = 0; j < 3; ++j)
                 result.m[i][j] = m[i][j] - rhs.m[i][j];
         return result;
     }
 
-    const f3& operator[](int a) const
+    constexpr const f3& operator[](int a) const
     {
         return m[a];
     }
 
-    f3& operator[](int a)
+    constexpr f3& operator[](int a)
     {
         return m[a];
     }
 
-    f trace() const
+    constexpr T trace() const
     {
         return m[0][0] + m[1][1] + m[2][2];
     }
+
+    // trace(M M^T), without forming the product
+    constexpr T squaredFrobeniusNorm() const
+    {
+        return dot(m[0], m[0]) + dot(m[1], m[1]) + dot(m[2], m[2]);
+    }
+
+    friend constexpr basic_f3x3 operator*(T scal, const basic_f3x3& m)
+    {
+        return m*scal;
+    }
 };
 
-inline std::ostream& operator<<(std::ostream& os, const f3x3& m) {
+using f3x3 = basic_f3x3<f>;
+
+template<class T>
+inline std::ostream& operator<<(std::ostream& os, const basic_f3x3<T>& m) {
     os << "[" << m[0] << ",\n" << m[1] << ",\n" << m[2] << "]";
     return os;
 }
 
-inline f3x3 operator*(f scal, const f3x3& m)
+// Diagonal 3x3 matrix, which the inertia tensors of the boxes are: the products scale
+// components, rows or columns and the inverse is component-wise.
+template<class T>
+struct BasicDiagonalMatrix3
 {
-    return m*scal;
+    using f3 = basic_f3<T>;
+    using f3x3 = basic_f3x3<T>;
+
+    f3 d;
+
+    constexpr BasicDiagonalMatrix3() = default;
+    constexpr explicit BasicDiagonalMatrix3(const f3& diagonal) : d(diagonal) {}
+
+    template<class U>
+    constexpr BasicDiagonalMatrix3<U> cast() const
+    {
+        return BasicDiagonalMatrix3<U>(d.template cast<U>());
+    }
+
+    constexpr f3x3 dense() const
+    {
+        return f3x3::diagonal(d);
+    }
+
+    constexpr BasicDiagonalMatrix3 inverse() const
+    {
+        return BasicDiagonalMatrix3(f3(T(1.0) / d.x, T(1.0) / d.y, T(1.0) / d.z));
+    }
+
+    constexpr f3 operator*(const f3& rhs) const
+    {
+        return d * rhs;
+    }
+
+    constexpr BasicDiagonalMatrix3 operator*(const BasicDiagonalMatrix3& rhs) const
+    {
+        return BasicDiagonalMatrix3(d * rhs.d);
+    }
+
+    // Scales the rows of rhs
+    constexpr f3x3 operator*(const f3x3& rhs) const
+    {
+        return f3x3(d.x * rhs[0], d.y * rhs[1], d.z * rhs[2]);
+    }
+
+    // Scales the columns of lhs
+    friend constexpr f3x3 operator*(const f3x3& lhs, const BasicDiagonalMatrix3& rhs)
+    {
+        return f3x3(lhs[0] * rhs.d, lhs[1] * rhs.d, lhs[2] * rhs.d);
+    }
+
+    constexpr BasicDiagonalMatrix3 operator*(T scal) const
+    {
+        return BasicDiagonalMatrix3(d * scal);
+    }
+
+    constexpr bool operator==(const BasicDiagonalMatrix3& rhs) const
+    {
+        return d == rhs.d;
+    }
+
+    // Diagonal entry i
+    constexpr T operator[](int i) const
+    {
+        return d[i];
+    }
+
+    constexpr T trace() const
+    {
+        return d.x + d.y + d.z;
+    }
+
+    static constexpr BasicDiagonalMatrix3 id()
+    {
+        return BasicDiagonalMatrix3(f3(1.0, 1.0, 1.0));
+    }
 };
 
-struct quat {
-    f x, y, z, w;
+using DiagonalMatrix3 = BasicDiagonalMatrix3<f>;
+
+// Rotations of a time step without sqrt, division or libm call: cos(phi) and
+// sin(phi) / phi of the half angle phi are even, so both are polynomials in phi^2. Up to
+// phi^2 = 1/16 (a rotation of 0.5 rad) the Taylor series are truncated where the next
+// term is below half an ulp of T, larger angles take sin and cos.
+static constexpr double expmap_polynomial_range = 1.0 / 16.0;
+
+// cos(phi) and sin(phi) / phi from z = phi^2 <= expmap_polynomial_range, by Horner's
+// rule. V is T or a SIMD pack of T (see 2023/kernels.inl).
+template<class T, class V>
+NERD_FORCEINLINE void halfAngleSeries(V z, V& cosine, V& sinc)
+{
+    static constexpr double cos_coefficients[] = { 1.0, -1.0 / 2.0, 1.0 / 24.0, -1.0 / 720.0, 1.0 / 40320.0,
+                                                   -1.0 / 3628800.0, 1.0 / 479001600.0 };
+    static constexpr double sinc_coefficients[] = { 1.0, -1.0 / 6.0, 1.0 / 120.0, -1.0 / 5040.0, 1.0 / 362880.0,
+                                                    -1.0 / 39916800.0, 1.0 / 6227020800.0 };
+    static constexpr int terms = std::is_same_v<T, float> ? 4 : 7;
+
+    cosine = V(T(cos_coefficients[terms - 1]));
+    sinc = V(T(sinc_coefficients[terms - 1]));
+    for (int k = terms - 2; k >= 0; --k)
+    {
+        cosine = cosine * z + V(T(cos_coefficients[k]));
+        sinc = sinc * z + V(T(sinc_coefficients[k]));
+    }
+}
+
+template<class T>
+struct basic_quat {
+    using f3 = basic_f3<T>;
+    using f3x3 = basic_f3x3<T>;
+
+    T x, y, z, w;
     // Constructors
-    quat() : w(1.0), x(0.0), y(0.0), z(0.0) {}
-    quat(f w, f x, f y, f z) : w(w), x(x), y(y), z(z) {}
-    quat(f w, f3 v) : w(w), x(v.x), y(v.y), z(v.z) {}
+    constexpr basic_quat() : w(1.0), x(0.0), y(0.0), z(0.0) {}
+    constexpr basic_quat(T w, T x, T y, T z) : w(w), x(x), y(y), z(z) {}
+    constexpr basic_quat(T w, f3 v) : w(w), x(v.x), y(v.y), z(v.z) {}
+
+    template<class U>
+    constexpr basic_quat<U> cast() const
+    {
+        return basic_quat<U>(static_cast<U>(w), static_cast<U>(x), static_cast<U>(y), static_cast<U>(z));
+    }
 
-    f norm() const {
-        return std::sqrt(w * w + x * x + y * y + z * z);
+    constexpr T norm() const {
+        using std::sqrt;
+        return sqrt(w * w + x * x + y * y + z * z);
     }
 
-    quat conjugate() const {
-        return quat(w, -x, -y, -z);
+    constexpr basic_quat conjugate() const {
+        return basic_quat(w, -x, -y, -z);
     }
 
-    void normalize() {
-        const f invNorm = 1.0 / this->norm();
+    constexpr void normalize() {
+        const T invNorm = T(1.0) / this->norm();
         w = w * invNorm;
         x = x * invNorm;
         y = y * invNorm;
         z = z * invNorm;
     }
 
-    quat normalized() const {
-        quat result;
-        const f invNorm = 1.0 / this->norm();
-        return quat(w * invNorm, x * invNorm, y * invNorm, z * invNorm);
+    constexpr basic_quat normalized() const {
+        const T invNorm = T(1.0) / this->norm();
+        return basic_quat(w * invNorm, x * invNorm, y * invNorm, z * invNorm);
     }
 
-    void operator+=(const quat& rhs) {
+    constexpr void operator+=(const basic_quat& rhs) {
         w += rhs.w;
         x += rhs.x;
         y += rhs.y;
         z += rhs.z;
     }
 
-    quat operator+(const quat& rhs) const {
-        return quat(w + rhs.w, x + rhs.x, y + rhs.y, z + rhs.z);
+    constexpr basic_quat operator+(const basic_quat& rhs) const {
+        return basic_quat(w + rhs.w, x + rhs.x, y + rhs.y, z + rhs.z);
     }
 
-    void operator-=(const quat& rhs) {
+    constexpr void operator-=(const basic_quat& rhs) {
         w -= rhs.w;
         x -= rhs.x;
         y -= rhs.y;
         z -= rhs.z;
     }
 
-    quat operator-(const quat& rhs) const {
-        return quat(w - rhs.w, x - rhs.x, y - rhs.y, z - rhs.z);
+    constexpr basic_quat operator-(const basic_quat& rhs) const {
+        return basic_quat(w - rhs.w, x - rhs.x, y - rhs.y, z - rhs.z);
     }
 
-    void operator*=(const quat& rhs) {
+    constexpr void operator*=(const basic_quat& rhs) {
         w = w * rhs.w - x * rhs.x - y * rhs.y - z * rhs.z;
         x = w * rhs.x + x * rhs.w + y * rhs.z - z * rhs.y;
         y = w * rhs.y - x * rhs.z + y * rhs.w + z * rhs.x;
         z = w * rhs.z + x * rhs.y - y * rhs.x + z * rhs.w;
     }
 
-    quat operator*(const quat& rhs) const {
-        return quat(
+    constexpr basic_quat operator*(const basic_quat& rhs) const {
+        return basic_quat(
             w * rhs.w - x * rhs.x - y * rhs.y - z * rhs.z,
             w * rhs.x + x * rhs.w + y * rhs.z - z * rhs.y,
             w * rhs.y - x * rhs.z + y * rhs.w + z * rhs.x,
@@ -301,56 +509,57 @@ struct quat {
         );
     }
 
-    quat operator*(f scalar) const {
-        return quat(w * scalar, x * scalar, y * scalar, z * scalar);
+    constexpr basic_quat operator*(T scalar) const {
+        return basic_quat(w * scalar, x * scalar, y * scalar, z * scalar);
     }
 
-    f3 rotate(const f3& vec) const
+    constexpr f3 rotate(const f3& vec) const
     {
         f3 u(x, y, z);
-        return 2.0 * dot(u, vec) * u
+        return T(2.0) * dot(u, vec) * u
             + (w * w - dot(u, u)) * vec
-            + 2.0 * w *cross(u, vec);
+            + T(2.0) * w *cross(u, vec);
     }
 
-    f3x3 rotate(const f3x3& mat) const
+    constexpr f3x3 rotate(const f3x3& mat) const
     {
         return f3x3{ this->rotate(mat[0]), this->rotate(mat[1]), this->rotate(mat[2]) };
     }
 
-    friend quat operator*(f scalar, const quat& quat) {
+    friend constexpr basic_quat operator*(T scalar, const basic_quat& quat) {
         return quat * scalar;
     };
 
-    friend std::ostream& operator<<(std::ostream& os, const quat& quat);
-
-    bool operator==(const quat& rhs) const {
+    constexpr bool operator==(const basic_quat& rhs) const {
         return (w == rhs.w && x == rhs.x && y == rhs.y && z == rhs.z);
     }
 
-    f3 ComputeAngularAcceleration(const f3& eulerMotionVector, const f3& w) const
+    static constexpr f3 ComputeAngularAcceleration(const f3& eulerMotionVector, const f3& w)
     {
         return f3{ eulerMotionVector[0] * w[1] * w[2],
                    eulerMotionVector[1] * w[0] * w[2],
                    eulerMotionVector[2] * w[0] * w[1]};
     }
 
-    f3 ComputeAngularVelocity(const f3& eulerMotionVector, const f3& w, const f dt) const
+    static constexpr f3 ComputeAngularVelocity(const f3& eulerMotionVector, const f3& w, const T dt)
     {
         // Runge Kutta
         const f3 k1 = ComputeAngularAcceleration(eulerMotionVector, w);
-        const f3 k2 = ComputeAngularAcceleration(eulerMotionVector, w + 0.5 * dt * k1);
-        const f3 k3 = ComputeAngularAcceleration(eulerMotionVector, w + 0.5 * dt * k2);
+        const f3 k2 = ComputeAngularAcceleration(eulerMotionVector, w + T(0.5) * dt * k1);
+        const f3 k3 = ComputeAngularAcceleration(eulerMotionVector, w + T(0.5) * dt * k2);
         const f3 k4 = ComputeAngularAcceleration(eulerMotionVector, w + dt * k3);
 
-        return w + (dt / 6.0) * (k1 + 2.0 * k2 + 2.0 * k3 + k4);
+        return w + (dt / T(6.0)) * (k1 + T(2.0) * k2 + T(2.0) * k3 + k4);
     }
 
-    static void computeCGCoeef(const f3& w, f b, f dt, quat& outQuat)
+    static void computeCGCoeef(const f3& w, T b, T dt, basic_quat& outQuat)
     {
-        const f angle = w.norm();
-        const f theta = angle * dt * 0.5 * b;
-        const f3 axis = sin(theta) * w / angle;
+        using std::sin, std::cos;
+        const T angle = w.norm();
+        const T halfStep = dt * T(0.5) * b;
+        const T theta = angle * halfStep;
+        // sin(theta) / angle tends to halfStep as w vanishes
+        const f3 axis = (angle > T(0.0) ? sin(theta) / angle : halfStep) * w;
 
         outQuat.w = cos(theta);
         outQuat.x = axis.x;
@@ -358,19 +567,143 @@ struct quat {
         outQuat.z = axis.z;
     }
 
-    void applyRotationStep(const f3& eulerMotionVector, f3& frame_angular_velocity, f dt)
+    // The rotation of half rotation vector h, exp(h) = (cos |h|, sin |h| / |h| * h), with
+    // cos and sin / angle from halfAngleSeries: no sqrt, division or libm call up to
+    // expmap_polynomial_range
+    NERD_FORCEINLINE static basic_quat halfRotationPolynomial(const f3& h)
+    {
+        using std::sin, std::cos, std::sqrt;
+        const T z = dot(h, h);
+        if (z > T(expmap_polynomial_range))
+        {
+            const T angle = sqrt(z);
+            return basic_quat(cos(angle), (sin(angle) / angle) * h);
+        }
+
+        T cosine, sinc;
+        halfAngleSeries<T>(z, cosine, sinc);
+        return basic_quat(cosine, sinc * h);
+    }
+
+    // Weights of the third order continuous extension of RK4 at fraction s of a step:
+    // w(s * dt) = w0 + dt * (d1 * k1 + d23 * (k2 + k3) + d4 * k4)
+    struct DenseOutputWeights
+    {
+        f d1, d23, d4;
+    };
+
+    static constexpr DenseOutputWeights ComputeDenseOutputWeights(f s)
+    {
+        return { s * (1.0 + s * (-1.5 + s * (2.0 / 3.0))),
+                 s * s * (1.0 - s * (2.0 / 3.0)),
+                 s * s * (-0.5 + s * (2.0 / 3.0)) };
+    }
+
+    NERD_FORCEINLINE void applyRotationStep(const f3& eulerMotionVector, f3& frame_angular_velocity, T dt)
     {
         //Crouch Grossman 3
         static constexpr f b1 = 13.0 / 51.0;
         static constexpr f b2 = - 2.0 / 3.0;
         static constexpr f b3 = 24.0 / 17.0;
 
-        static constexpr f c1 = 0.0;
         static constexpr f c2 = 3.0 / 4.0;
         static constexpr f c3 = 17.0 / 24.0;
+        static constexpr DenseOutputWeights d2 = ComputeDenseOutputWeights(c2);
+        static constexpr DenseOutputWeights d3 = ComputeDenseOutputWeights(c3);
+
+        // A single RK4 step gives w(dt); w at c2 * dt and c3 * dt is read from the
+        // continuous extension of the same stages instead of restarting RK4 per stage.
+        const f3 w0 = frame_angular_velocity;
+        const f3 k1 = ComputeAngularAcceleration(eulerMotionVector, w0);
+        const f3 k2 = ComputeAngularAcceleration(eulerMotionVector, w0 + T(0.5) * dt * k1);
+        const f3 k3 = ComputeAngularAcceleration(eulerMotionVector, w0 + T(0.5) * dt * k2);
+        const f3 k4 = ComputeAngularAcceleration(eulerMotionVector, w0 + dt * k3);
+        const f3 k23 = k2 + k3;
+
+        // Half rotation vectors b * dt / 2 * w(c * dt), the weights folded at compile time
+        const T halfStep = T(0.5) * dt;
+        const T halfStep2 = halfStep * dt;
+        const f3 h1 = (T(b1) * halfStep) * w0;
+        const f3 h2 = (T(b2) * halfStep) * w0 + halfStep2 * (T(b2 * d2.d1) * k1 + T(b2 * d2.d23) * k23 + T(b2 * d2.d4) * k4);
+        const f3 h3 = (T(b3) * halfStep) * w0 + halfStep2 * (T(b3 * d3.d1) * k1 + T(b3 * d3.d23) * k23 + T(b3 * d3.d4) * k4);
+
+        // Compose the stage rotations first so the orientation is updated only once
+        basic_quat& orientation = *this;
+        orientation = orientation * (halfRotationPolynomial(h1) * halfRotationPolynomial(h2) * halfRotationPolynomial(h3));
+
+        frame_angular_velocity = w0 + (dt / T(6.0)) * (k1 + T(2.0) * k23 + k4);
+    }
+
+    // Discrete Moser-Veselov step of the free rigid body. With m the body angular
+    // momentum and J = diag(tr(I) / 2 - I), the step rotation Omega solves
+    // dt * hat(m) = Omega^T J - J Omega, then m' = Omega m and q' = q Omega^T.
+    // In the unit quaternion (w, v) of Omega this reads dt * m = 2 (J v) x v - 2 w I v,
+    // solved by Newton's method from the small step guess v = -dt / 2 * w.
+    // Energy and |m| are conserved exactly, the method is second order in time.
+    // Returns false, with the state left as it was, when Newton's method does not
+    // converge (too large a time step): the caller decides how to report it.
+    [[nodiscard]] bool applyMoserVeselovStep(const f3& inertia, f3& body_angular_momentum, T dt)
+    {
+        static constexpr int max_iterations = 50;
+        const T tolerance = T(16.0) * std::numeric_limits<T>::epsilon();
+
+        const f3& m = body_angular_momentum;
+        const f3 J = T(0.5) * (inertia[0] + inertia[1] + inertia[2]) * f3(T(1.0), T(1.0), T(1.0)) - inertia;
+        const f3 target = T(0.5) * dt * m;
+
+        f3 v = T(-0.5) * dt * f3(m.x / inertia.x, m.y / inertia.y, m.z / inertia.z);
+        T w = std::sqrt(T(1.0) - dot(v, v));
+        for (int iteration = 0;; ++iteration)
+        {
+            if (iteration == max_iterations || !(w > T(0.0)))
+            {
+                return false;
+            }
+
+            const f3 Jv = J * v;
+            const f3 Iv = inertia * v;
+            const f3 residual = cross(Jv, v) - w * Iv - target;
+
+            // Jacobian of the residual: hat(Jv) - hat(v) J - w I + (I v) v^T / w
+            const f3x3 jacobian{
+                f3(-w * inertia.x + Iv.x * v.x / w, -Jv.z + v.z * J.y + Iv.x * v.y / w, Jv.y - v.y * J.z + Iv.x * v.z / w),
+                f3(Jv.z - v.z * J.x + Iv.y * v.x / w, -w * inertia.y + Iv.y * v.y / w, -Jv.x + v.x * J.z + Iv.y * v.z / w),
+                f3(-Jv.y + v.y * J.x + Iv.z * v.x / w, Jv.x - v.x * J.y + Iv.z * v.y / w, -w * inertia.z + Iv.z * v.z / w) };
+
+            // Cramer's rule with the cofactors as cross products of the rows
+            const f3 c0 = cross(jacobian[1], jacobian[2]);
+            const f3 c1 = cross(jacobian[2], jacobian[0]);
+            const f3 c2 = cross(jacobian[0], jacobian[1]);
+            const f3 delta = (residual.x * c0 + residual.y * c1 + residual.z * c2) / dot(jacobian[0], c0);
+
+            v = v - delta;
+            w = std::sqrt(T(1.0) - dot(v, v));
+            if (dot(delta, delta) <= tolerance * tolerance * std::max(dot(v, v), std::numeric_limits<T>::min()))
+            {
+                break;
+            }
+        }
+
+        const basic_quat omega(w, v);
+        body_angular_momentum = omega.rotate(m);
+        *this = *this * omega.conjugate();
+        return true;
+    }
+
+    // Original kernel, restarting RK4 from the step start for every stage (12 Euler
+    // evaluations per step instead of 4). Kept as the baseline for benchmarks.
+    void applyRotationStepRK4Restart(const f3& eulerMotionVector, f3& frame_angular_velocity, T dt)
+    {
+        //Crouch Grossman 3
+        static constexpr T b1 = 13.0 / 51.0;
+        static constexpr T b2 = - 2.0 / 3.0;
+        static constexpr T b3 = 24.0 / 17.0;
+
+        static constexpr T c2 = 3.0 / 4.0;
+        static constexpr T c3 = 17.0 / 24.0;
 
-        quat& orientation = *this;
-        quat k;
+        basic_quat& orientation = *this;
+        basic_quat k;
         computeCGCoeef(frame_angular_velocity, b1, dt, k);
         orientation = orientation * k;
         computeCGCoeef(ComputeAngularVelocity(eulerMotionVector, frame_angular_velocity, c2 * dt), b2, dt, k);
@@ -382,14 +715,19 @@ struct quat {
     }
 };
 
-inline std::ostream& operator<<(std::ostream& os, const quat& quat) {
+using quat = basic_quat<f>;
+
+template<class T>
+inline std::ostream& operator<<(std::ostream& os, const basic_quat<T>& quat) {
     os << quat.w << " + " << quat.x << "i + " << quat.y << "j + " << quat.z << "k";
     return os;
 }
 
 // Function to convert a quaternion to the final matrix
-inline f3x3 quaternionToMatrix(const quat& q) {
-    f3x3 matrix
+template<class T>
+constexpr basic_f3x3<T> quaternionToMatrix(const basic_quat<T>& q) {
+    using f3 = basic_f3<T>;
+    basic_f3x3<T> matrix
     {
         f3(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y - q.z * q.w), 2.0f * (q.x * q.z + q.y * q.w)),
         f3(2.0f * (q.x * q.y + q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z - q.x * q.w)),
@@ -398,55 +736,230 @@ inline f3x3 quaternionToMatrix(const quat& q) {
     return matrix;
 }
 
-struct SimulationContext
+// Orthonormal 3x3 matrix of determinant 1. The inverse is the transpose, which the
+// products by an inverse never form, and the conversions to and from quat are exact up
+// to rounding. Converts implicitly to the dense f3x3 the simulations return.
+template<class T>
+struct BasicRotationMatrix3
 {
-    f density{};                            // Density of the rectangular parallelepiped. The density is uniform.
+    using f3 = basic_f3<T>;
+    using f3x3 = basic_f3x3<T>;
+    using quat = basic_quat<T>;
+
+    f3x3 m = f3x3::id();
+
+    constexpr BasicRotationMatrix3() = default;
+
+    // q has to be a unit quaternion
+    constexpr explicit BasicRotationMatrix3(const quat& q) : m(quaternionToMatrix(q)) {}
+
+    // The caller guarantees that m is a rotation, nothing is checked
+    static constexpr BasicRotationMatrix3 fromOrthonormal(const f3x3& m)
+    {
+        BasicRotationMatrix3 result;
+        result.m = m;
+        return result;
+    }
+
+    template<class U>
+    constexpr BasicRotationMatrix3<U> cast() const
+    {
+        return BasicRotationMatrix3<U>::fromOrthonormal(m.template cast<U>());
+    }
+
+    constexpr const f3x3& matrix() const
+    {
+        return m;
+    }
+
+    constexpr operator const f3x3&() const
+    {
+        return m;
+    }
+
+    constexpr BasicRotationMatrix3 inverse() const
+    {
+        return fromOrthonormal(m.transpose());
+    }
+
+    constexpr f3 operator*(const f3& rhs) const
+    {
+        return m * rhs;
+    }
+
+    // inverse() * rhs: a combination of the rows, no transpose
+    constexpr f3 inverseRotate(const f3& rhs) const
+    {
+        return rhs.x * m[0] + rhs.y * m[1] + rhs.z * m[2];
+    }
+
+    constexpr BasicRotationMatrix3 operator*(const BasicRotationMatrix3& rhs) const
+    {
+        return fromOrthonormal(m * rhs.m);
+    }
+
+    constexpr f3x3 operator*(const f3x3& rhs) const
+    {
+        return m * rhs;
+    }
+
+    // Shepperd's method: the square root is taken of the largest of 4 w^2, 4 x^2,
+    // 4 y^2, 4 z^2 so that the divisions stay well conditioned. Returns w >= 0.
+    quat toQuat() const
+    {
+        using std::sqrt;
+        const T trace = m.trace();
+        quat q;
+        if (trace >= m[0][0] && trace >= m[1][1] && trace >= m[2][2])
+        {
+            const T s = T(2.0) * sqrt(T(1.0) + trace);
+            q = quat(T(0.25) * s, (m[2][1] - m[1][2]) / s, (m[0][2] - m[2][0]) / s, (m[1][0] - m[0][1]) / s);
+        }
+        else if (m[0][0] >= m[1][1] && m[0][0] >= m[2][2])
+        {
+            const T s = T(2.0) * sqrt(T(1.0) + m[0][0] - m[1][1] - m[2][2]);
+            q = quat((m[2][1] - m[1][2]) / s, T(0.25) * s, (m[0][1] + m[1][0]) / s, (m[0][2] + m[2][0]) / s);
+        }
+        else if (m[1][1] >= m[2][2])
+        {
+            const T s = T(2.0) * sqrt(T(1.0) + m[1][1] - m[0][0] - m[2][2]);
+            q = quat((m[0][2] - m[2][0]) / s, (m[0][1] + m[1][0]) / s, T(0.25) * s, (m[1][2] + m[2][1]) / s);
+        }
+        else
+        {
+            const T s = T(2.0) * sqrt(T(1.0) + m[2][2] - m[0][0] - m[1][1]);
+            q = quat((m[1][0] - m[0][1]) / s, (m[0][2] + m[2][0]) / s, (m[1][2] + m[2][1]) / s, T(0.25) * s);
+        }
+        return q.w < T(0.0) ? T(-1.0) * q : q;
+    }
+};
+
+using RotationMatrix3 = BasicRotationMatrix3<f>;
+
+template<class T>
+struct BasicSimulationContext
+{
+    using f3 = basic_f3<T>;
+    using f3x3 = basic_f3x3<T>;
+    using DiagonalMatrix3 = BasicDiagonalMatrix3<T>;
+
+    T density{};                            // Density of the rectangular parallelepiped. The density is uniform.
     f3 lengths{};                           // Lengths of the three axes of the rectangular parallelepiped
     f3 initial_impulse{};                   // Initial impulse value
     f3 initial_impulse_application_point{}; // Point on the body where the impulse is applied
 
-    f final_time;                           // Final time of the simulation
+    T final_time{};                         // Final time of the simulation
 
-	f mass() const
-	{
-		return lengths[0] * lengths[1] * lengths[2] * density;
-	}
+    // A default constructed context is a placeholder to assign a valid one to
+    constexpr BasicSimulationContext() = default;
 
-	f3x3 ComputeInertiaTensor() const
-	{
-		const f mass = this->mass();
-		return f3x3{ f3((pow(lengths[1], 2) + pow(lengths[2], 2))* mass / 12.0 , 0.0, 0.0),
-			f3(0.0, (pow(lengths[0], 2) + pow(lengths[2], 2))* mass / 12.0 , 0.0),
-			f3(0.0, 0.0, (pow(lengths[0], 2) + pow(lengths[1], 2))* mass / 12.0) };
-	}
+    // Rejects the contexts the simulations cannot integrate, so they need no check of
+    // their own in the step loops (see MathChecks)
+    constexpr BasicSimulationContext(T density, const f3& lengths, const f3& initial_impulse, const f3& initial_impulse_application_point, T final_time)
+        : density(density), lengths(lengths), initial_impulse(initial_impulse),
+          initial_impulse_application_point(initial_impulse_application_point), final_time(final_time)
+    {
+        using std::isfinite;
+        if (!(density > 0.0) || !isfinite(density))
+        {
+            throw std::runtime_error("Null density is not allowed!");
+        }
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (!(lengths[axis] > 0.0) || !isfinite(lengths[axis]))
+            {
+                throw std::runtime_error("Body lengths must be positive!");
+            }
+            if (!isfinite(initial_impulse[axis]) || !isfinite(initial_impulse_application_point[axis]))
+            {
+                throw std::runtime_error("Initial impulse must be finite!");
+            }
+        }
+        if (!(final_time >= 0.0) || !isfinite(final_time))
+        {
+            throw std::runtime_error("Final time must be positive!");
+        }
+    }
+
+    template<class U>
+    constexpr BasicSimulationContext<U> cast() const
+    {
+        return { static_cast<U>(density), lengths.template cast<U>(), initial_impulse.template cast<U>(),
+                 initial_impulse_application_point.template cast<U>(), static_cast<U>(final_time) };
+    }
 
-	f3x3 ComputeInvInertiaTensor() const
+	constexpr T mass() const
 	{
-		const f mass = this->mass();
-		if (mass <= 0.0)
-		{
-			throw std::runtime_error("Null density is not allowed!");
-		}
-
-		return f3x3{ f3(12.0 / ((pow(lengths[1], 2) + pow(lengths[2], 2))* mass) , 0.0, 0.0),
-			f3(0.0, 12.0 / ((pow(lengths[0], 2) + pow(lengths[2], 2))* mass) , 0.0),
-			f3(0.0, 0.0, 12.0 / ((pow(lengths[0], 2) + pow(lengths[1], 2))* mass)) };
+		return lengths[0] * lengths[1] * lengths[2] * density;
 	}
 
-    f3 ComputeInitialAngularVelocity(const f3x3& invInertiaTensor) const
+    // The principal axes of the box are its body axes, so both tensors are diagonal
+    constexpr DiagonalMatrix3 ComputeInertiaTensor() const
     {
-        const f mass = this->mass();
-        if (mass <= 0.0)
-        {
-            throw std::runtime_error("Null density is not allowed!");
-        }
+        const T mass = this->mass();
+        return DiagonalMatrix3(f3((lengths[1] * lengths[1] + lengths[2] * lengths[2]) * mass / 12.0,
+                                  (lengths[0] * lengths[0] + lengths[2] * lengths[2]) * mass / 12.0,
+                                  (lengths[0] * lengths[0] + lengths[1] * lengths[1]) * mass / 12.0));
+    }
 
+    // The constructor rejects a null density, checkDivisor only guards the math
+    constexpr DiagonalMatrix3 ComputeInvInertiaTensor() const
+    {
+        const T mass = this->mass();
+        checkDivisor(mass);
+
+        return DiagonalMatrix3(f3(12.0 / ((lengths[1] * lengths[1] + lengths[2] * lengths[2]) * mass),
+                                  12.0 / ((lengths[0] * lengths[0] + lengths[2] * lengths[2]) * mass),
+                                  12.0 / ((lengths[0] * lengths[0] + lengths[1] * lengths[1]) * mass)));
+    }
+
+    constexpr f3 ComputeInitialAngularVelocity(const DiagonalMatrix3& invInertiaTensor) const
+    {
         f3 torque = cross(initial_impulse_application_point, initial_impulse);
 
         return invInertiaTensor * torque;
     }
+
+    // ((I1 - I2) / I0, (I2 - I0) / I1, (I0 - I1) / I2) of the principal moments, see
+    // quat::ComputeAngularAcceleration
+    constexpr f3 ComputeEulerMotionVector(const DiagonalMatrix3& inertiaTensor) const
+    {
+        const f3& I = inertiaTensor.d;
+        return f3{ (I[1] - I[2]) / I[0],
+                   (I[2] - I[0]) / I[1],
+                   (I[0] - I[1]) / I[2] };
+    }
+};
+
+using SimulationContext = BasicSimulationContext<f>;
+
+// What the integrators read from a context, computed once. Everything is constexpr, so
+// a fixed table of scenarios can be prepared at compile time, and a batch of many small
+// ones prepared once up front (see SimulateBatch).
+template<class T>
+struct BasicPreparedContext
+{
+    using f3 = basic_f3<T>;
+
+    f3 inertia;             // Principal moments of inertia, the diagonal of ComputeInertiaTensor
+    f3 euler_motion_vector; // See ComputeEulerMotionVector
+    f3 angular_velocity;    // Initial angular velocity in the body frame
+    T final_time{};
+
+    constexpr BasicPreparedContext() = default;
+
+    constexpr explicit BasicPreparedContext(const BasicSimulationContext<T>& context)
+        : final_time(context.final_time)
+    {
+        const BasicDiagonalMatrix3<T> I = context.ComputeInertiaTensor();
+        inertia = I.d;
+        euler_motion_vector = context.ComputeEulerMotionVector(I);
+        angular_velocity = context.ComputeInitialAngularVelocity(context.ComputeInvInertiaTensor());
+    }
 };
 
+using PreparedContext = BasicPreparedContext<f>;
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "physicshelper.h"
+#include "integrators.h"
+
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+
+namespace rigidbody
+{
+namespace splitting
+{
+// Splitting integrators of the free rigid body in the body angular momentum m.
+// The kinetic energy is split as
+//   H = |m|^2 / (2 I_a) + k_b m_b^2 / 2 + k_c m_c^2 / 2,  k_i = 1 / I_i - 1 / I_a,
+// where every piece is a rotation about a fixed axis with an exact flow. |m|^2 is a
+// Casimir, so its flow commutes with the two others and is applied once over the
+// whole run (FreeRotor::casimirFlow). The remaining two pieces are composed with
+// the Strang step and one of the symmetric compositions below. Every sub-flow is a
+// Lie-Poisson map, so |m| is exact and the energy error stays bounded.
+
+// Symmetric compositions S(w_0 dt) ... S(w_n dt) of the Strang step S
+struct Strang2
+{
+    static constexpr const char* name = "Strang2";
+    static constexpr int order = 2;
+    static constexpr f weights[] = { 1.0 };
+};
+
+// Triple jump
+struct Yoshida4
+{
+    static constexpr f cbrt2 = 1.25992104989487316477;
+    static constexpr f w1 = 1.0 / (2.0 - cbrt2);
+    static constexpr f w0 = -cbrt2 / (2.0 - cbrt2);
+
+    static constexpr const char* name = "Yoshida4";
+    static constexpr int order = 4;
+    static constexpr f weights[] = { w1, w0, w1 };
+};
+
+// Five stage fractal composition, smaller error constant than the triple jump
+struct Suzuki4
+{
+    static constexpr f cbrt4 = 1.58740105196819947475;
+    static constexpr f p = 1.0 / (4.0 - cbrt4);
+
+    static constexpr const char* name = "Suzuki4";
+    static constexpr int order = 4;
+    static constexpr f weights[] = { p, p, 1.0 - 4.0 * p, p, p };
+};
+
+// Yoshida's seven stage solution A
+struct Yoshida6
+{
+    static constexpr f w1 = -1.17767998417887100695;
+    static constexpr f w2 = 0.235573213359358133684;
+    static constexpr f w3 = 0.784513610477557263820;
+    static constexpr f w0 = 1.0 - 2.0 * (w1 + w2 + w3);
+
+    static constexpr const char* name = "Yoshida6";
+    static constexpr int order = 6;
+    static constexpr f weights[] = { w3, w2, w1, w0, w1, w2, w3 };
+};
+
+// Tells the compositions above from the integrator policies of integrators.h
+template<class Composition>
+constexpr bool is_composition = requires { Composition::weights; };
+
+template<class T>
+struct FreeRotor
+{
+    using f3 = basic_f3<T>;
+    using quat = basic_quat<T>;
+
+    f3 inertia;
+    int a, b, c;
+    T kb, kc;
+
+    // a is picked to minimise the coupling k_b k_c of the two split pieces: it is
+    // zero for a symmetric top, which is then integrated exactly.
+    explicit FreeRotor(const f3& inertia) : inertia(inertia), a(0), b(1), c(2), kb(0.0), kc(0.0)
+    {
+        T bestCoupling = -1.0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const int next = (axis + 1) % 3;
+            const int last = (axis + 2) % 3;
+            const T kNext = T(1.0) / inertia[next] - T(1.0) / inertia[axis];
+            const T kLast = T(1.0) / inertia[last] - T(1.0) / inertia[axis];
+            const T coupling = std::abs(kNext * kLast);
+            if (bestCoupling < 0.0 || coupling < bestCoupling)
+            {
+                bestCoupling = coupling;
+                a = axis;
+                b = next;
+                c = last;
+                kb = kNext;
+                kc = kLast;
+            }
+        }
+    }
+
+    T energy(const f3& m) const
+    {
+        return T(0.5) * (m.x * m.x / inertia.x + m.y * m.y / inertia.y + m.z * m.z / inertia.z);
+    }
+
+    // Exact flow of k m_axis^2 / 2 over tau: m rotates by -angle and the body by
+    // +angle about the axis, angle = tau k m_axis. The half angle of a time step is
+    // small, its sin and cos come from halfAngleSeries.
+    static void axisFlow(quat& orientation, f3& m, int axis, T k, T tau)
+    {
+        const T halfAngle = T(0.5) * tau * k * m[axis];
+        const int j = (axis + 1) % 3;
+        const int l = (axis + 2) % 3;
+
+        T halfSin, halfCos;
+        const T z = halfAngle * halfAngle;
+        if (z > T(expmap_polynomial_range))
+        {
+            halfSin = std::sin(halfAngle);
+            halfCos = std::cos(halfAngle);
+        }
+        else
+        {
+            T sinc;
+            halfAngleSeries<T>(z, halfCos, sinc);
+            halfSin = sinc * halfAngle;
+        }
+        const T s = T(2.0) * halfSin * halfCos;
+        const T co = T(1.0) - T(2.0) * halfSin * halfSin;
+        const T mj = m[j];
+        const T ml = m[l];
+        m[j] = co * mj + s * ml;
+        m[l] = co * ml - s * mj;
+
+        // orientation * (halfCos, halfSin e_axis), written out for the single axis
+        f3 v(orientation.x, orientation.y, orientation.z);
+        const T w = orientation.w;
+        const T va = v[axis];
+        const T vj = v[j];
+        const T vl = v[l];
+        v[axis] = halfCos * va + halfSin * w;
+        v[j] = halfCos * vj + halfSin * vl;
+        v[l] = halfCos * vl - halfSin * vj;
+        orientation = quat(halfCos * w - halfSin * va, v);
+    }
+
+    // Composition of Strang steps B(w dt / 2) C(w dt) B(w dt / 2) where the
+    // consecutive B half steps are merged into one flow
+    template<class Composition>
+    void step(quat& orientation, f3& m, T dt) const
+    {
+        static constexpr size_t stages = std::size(Composition::weights);
+
+        T pending = T(0.5 * Composition::weights[0]) * dt;
+        for (size_t stage = 0; stage < stages; ++stage)
+        {
+            axisFlow(orientation, m, b, kb, pending);
+            axisFlow(orientation, m, c, kc, T(Composition::weights[stage]) * dt);
+            const f next = stage + 1 < stages ? Composition::weights[stage + 1] : 0.0;
+            pending = T(0.5 * (Composition::weights[stage] + next)) * dt;
+        }
+        axisFlow(orientation, m, b, kb, pending);
+    }
+
+    // Exact flow of |m|^2 / (2 I_a) over t: m is unchanged and the body rotates by
+    // t |m| / I_a about m
+    void casimirFlow(quat& orientation, const f3& m, T t) const
+    {
+        orientation = orientation * expmap((t / inertia[a]) * m);
+    }
+};
+
+} // namespace splitting
+} // namespace rigidbody